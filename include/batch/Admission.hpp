@@ -0,0 +1,136 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+#include "registration/MemoryBudget.hpp"
+
+namespace itkexp {
+
+    // What one batch job runs, as far as its memory is concerned.
+    struct JobFootprint
+    {
+        bool         cachedGradients   = true; // affine metric caches gradient images
+        unsigned int affineLevels      = 3;
+        bool         bspline           = false;
+        unsigned int bsplineLevels     = 1;
+        unsigned int bsplineParameters = 0; // coefficients of the finest mesh
+        bool         demons            = false;
+        unsigned int demonsLevels      = 3;
+    };
+
+    // Histogram bins of the Mattes metric of the B-spline stage (see bsplineRegisterTransform).
+    constexpr double kMattesHistogramBins = 50;
+
+    // Estimated peak bytes of one job registering a moving image onto the fixed grid: both
+    // inputs, plus the largest stage working set (stages run one after another), plus the
+    // registered images held until they are handed to the writer. Per stage, beyond inputs:
+    //   affine    the smoothed copies and virtual domains of its pyramid and, if cached, a
+    //             gradient image per voxel of both images (see registrationBytesPerVoxel)
+    //   B-spline  the same for its own pyramid without gradient images (the stage turns the
+    //             gradient filters off), plus the joint-PDF derivatives Mattes keeps for a
+    //             transform without local support: bins x bins doubles per parameter
+    //   demons    the images of every pyramid level, a histogram-matched moving image and four
+    //             vector fields on the fixed grid (field, update, smoothing buffer, initial
+    //             field)
+    template <typename TImage>
+    std::size_t estimateJobBytes(double fixedVoxels, double movingVoxels,
+                                 const JobFootprint& job)
+    {
+        constexpr double pixel  = sizeof(typename TImage::PixelType);
+        constexpr double vector = TImage::ImageDimension * sizeof(float);
+        const double     both   = fixedVoxels + movingVoxels;
+
+        const double inputs = pixel * both;
+        double       stage =
+            (registrationBytesPerVoxel<TImage>(job.affineLevels, job.cachedGradients) - pixel) *
+            both;
+        if (job.bspline) {
+            const double jointPdfDerivatives = kMattesHistogramBins * kMattesHistogramBins *
+                                               job.bsplineParameters * sizeof(double);
+            const double pyramid =
+                (registrationBytesPerVoxel<TImage>(job.bsplineLevels, false) - pixel) * both;
+            stage = std::max(stage, pyramid + jointPdfDerivatives);
+        }
+        if (job.demons) {
+            double pyramid = 0.0;
+            for (unsigned int level = 0; level < std::max(1u, job.demonsLevels); ++level)
+                pyramid += 1.0 / (1u << (3 * level));
+            stage = std::max(stage, pyramid * pixel * both + pixel * movingVoxels +
+                                        4 * vector * fixedVoxels);
+        }
+        const unsigned int outputs = std::max(1u, unsigned(job.bspline) + unsigned(job.demons));
+        return static_cast<std::size_t>(inputs + stage + outputs * pixel * fixedVoxels);
+    }
+
+    /**
+     * @brief Admits jobs while the sum of their estimated bytes stays under a budget
+     *
+     * acquire() blocks until the request fits next to the jobs already admitted. A request
+     * larger than the whole budget is admitted alone, so an oversized subject runs (without
+     * company) instead of blocking forever. A zero budget admits everything.
+     */
+    class ByteSemaphore
+    {
+      public:
+        // Releases its bytes when destroyed.
+        class Lease
+        {
+          public:
+            Lease() = default;
+            Lease(ByteSemaphore* owner, std::size_t bytes) : owner_(owner), bytes_(bytes) {}
+            Lease(Lease&& other) noexcept : owner_(other.owner_), bytes_(other.bytes_)
+            {
+                other.owner_ = nullptr;
+            }
+            Lease& operator=(Lease&&) = delete;
+            ~Lease()
+            {
+                if (owner_)
+                    owner_->release(bytes_);
+            }
+
+          private:
+            ByteSemaphore* owner_ = nullptr;
+            std::size_t    bytes_ = 0;
+        };
+
+        explicit ByteSemaphore(std::size_t capacity) : capacity_(capacity) {}
+
+        [[nodiscard]] Lease acquire(std::size_t bytes)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            freed_.wait(lock, [&] {
+                return !capacity_ || used_ == 0 || used_ + bytes <= capacity_;
+            });
+            used_ += bytes;
+            highWater_ = std::max(highWater_, used_);
+            return Lease(this, bytes);
+        }
+
+        // Largest sum of admitted estimates so far.
+        std::size_t highWater() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return highWater_;
+        }
+
+      private:
+        void release(std::size_t bytes)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                used_ -= bytes;
+            }
+            freed_.notify_all();
+        }
+
+        const std::size_t       capacity_;
+        std::size_t             used_      = 0;
+        std::size_t             highWater_ = 0;
+        mutable std::mutex      mutex_;
+        std::condition_variable freed_;
+    };
+
+}  // namespace itkexp
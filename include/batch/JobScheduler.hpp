@@ -0,0 +1,218 @@
+#pragma once
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "itkMultiThreaderBase.h"
+
+namespace itkexp {
+
+    // Serializes whole lines from concurrent jobs so their progress messages do not interleave.
+    inline void logLine(const std::string& line, std::ostream& out = std::cout)
+    {
+        static std::mutex           mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        out << line << '\n' << std::flush;
+    }
+
+    // User + system CPU time consumed by this process so far, in seconds.
+    inline double processCpuSeconds()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        auto seconds = [](const timeval& t) { return t.tv_sec + t.tv_usec * 1e-6; };
+        return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+    }
+
+    // Split of the core budget between concurrent jobs and ITK threads inside each job.
+    struct JobSplit
+    {
+        unsigned int jobs          = 1;
+        unsigned int threadsPerJob = 1;
+    };
+
+    // ITK's registration filters stop scaling after a few threads, so by default each job gets
+    // 4 threads and the remaining cores go to more concurrent jobs (never more than jobCount).
+    // Either value can be fixed by the caller (non-zero) and the other is derived from it.
+    inline JobSplit chooseJobSplit(unsigned int cores, std::size_t jobCount,
+                                   unsigned int jobs = 0, unsigned int threadsPerJob = 0)
+    {
+        constexpr unsigned int kDefaultThreadsPerJob = 4;
+        cores = std::max(1u, cores);
+        const auto maxJobs =
+            static_cast<unsigned int>(std::clamp<std::size_t>(jobCount, 1, cores));
+
+        JobSplit split;
+        if (jobs && threadsPerJob) {
+            split = {jobs, threadsPerJob};
+        } else if (jobs) {
+            split.jobs          = jobs;
+            split.threadsPerJob = std::max(1u, cores / jobs);
+        } else {
+            split.threadsPerJob = threadsPerJob ? threadsPerJob
+                                                : std::min(kDefaultThreadsPerJob, cores);
+            split.jobs = std::clamp(cores / split.threadsPerJob, 1u, maxJobs);
+            if (!threadsPerJob) // give cores left idle by a short job list back to ITK
+                split.threadsPerJob = std::max(split.threadsPerJob, cores / split.jobs);
+        }
+        return split;
+    }
+
+    // Make every ITK filter created from now on use threadsPerJob threads of its own. The
+    // default pool threader shares one global pool between all jobs, so concurrent jobs
+    // would queue behind each other; the platform threader spawns per-filter threads.
+    inline void configureItkThreadsPerJob(unsigned int threadsPerJob)
+    {
+        itk::MultiThreaderBase::SetGlobalDefaultThreader(
+            itk::MultiThreaderBaseEnums::Threader::Platform);
+        itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(threadsPerJob);
+    }
+
+    /**
+     * @brief Fixed-size work-stealing pool for coarse jobs (one subject each)
+     *
+     * Jobs are dealt round-robin onto per-worker deques. A worker takes jobs from the front of
+     * its own deque (submission order) and, when it runs dry, steals from the back of another
+     * worker's deque, so one slow subject does not leave jobs stuck behind it.
+     */
+    class JobScheduler
+    {
+      public:
+        using Job = std::function<void()>;
+
+        explicit JobScheduler(unsigned int workers)
+        {
+            workers = std::max(1u, workers);
+            for (unsigned int i = 0; i < workers; ++i)
+                queues_.push_back(std::make_unique<Queue>());
+            for (unsigned int i = 0; i < workers; ++i)
+                threads_.emplace_back([this, i] { run(i); });
+        }
+
+        ~JobScheduler()
+        {
+            wait();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wakeup_.notify_all();
+            for (auto& thread : threads_)
+                thread.join();
+        }
+
+        JobScheduler(const JobScheduler&)            = delete;
+        JobScheduler& operator=(const JobScheduler&) = delete;
+
+        void submit(Job job)
+        {
+            auto& queue = *queues_[next_++ % queues_.size()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.jobs.push_back(std::move(job));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++queued_;
+                ++unfinished_;
+            }
+            wakeup_.notify_one();
+        }
+
+        // Block until every submitted job has finished.
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [this] { return unfinished_ == 0; });
+        }
+
+        std::size_t workerCount() const { return threads_.size(); }
+
+      private:
+        struct Queue
+        {
+            std::mutex      mutex;
+            std::deque<Job> jobs;
+        };
+
+        bool popOwn(std::size_t self, Job& job)
+        {
+            auto&                       queue = *queues_[self];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                return false;
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            return true;
+        }
+
+        bool steal(std::size_t self, Job& job)
+        {
+            for (std::size_t k = 1; k < queues_.size(); ++k) {
+                auto&                       victim = *queues_[(self + k) % queues_.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.jobs.empty()) {
+                    job = std::move(victim.jobs.back());
+                    victim.jobs.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void run(std::size_t self)
+        {
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wakeup_.wait(lock, [this] { return stop_ || queued_ > 0; });
+                    if (queued_ == 0)
+                        return; // stopping and nothing left
+                    --queued_;
+                }
+
+                // queued_ reserved one job for this worker; it is in some deque
+                Job job;
+                while (!popOwn(self, job) && !steal(self, job))
+                    std::this_thread::yield();
+
+                // Jobs report their own errors; anything escaping is logged here so it cannot
+                // terminate the worker (and with it the whole batch)
+                try {
+                    job();
+                } catch (const std::exception& e) {
+                    logLine(std::string("❌ Job failed: ") + e.what(), std::cerr);
+                } catch (...) {
+                    logLine("❌ Job failed with an unknown exception", std::cerr);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--unfinished_ == 0)
+                    idle_.notify_all();
+            }
+        }
+
+        std::vector<std::unique_ptr<Queue>> queues_;
+        std::vector<std::thread>            threads_;
+        std::atomic<std::size_t>            next_{0};
+        std::mutex                          mutex_;
+        std::condition_variable             wakeup_;
+        std::condition_variable             idle_;
+        std::size_t                         queued_     = 0;
+        std::size_t                         unfinished_ = 0;
+        bool                                stop_       = false;
+    };
+
+}  // namespace itkexp
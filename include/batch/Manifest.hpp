@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef ITKEXP_VERSION
+#define ITKEXP_VERSION "dev"
+#endif
+
+namespace itkexp {
+
+    // 64-bit FNV-1a, continued from hash (pass the previous value to hash several pieces).
+    inline std::uint64_t fnv1a(const void* data, std::size_t size,
+                               std::uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    inline std::string hexHash(std::uint64_t hash)
+    {
+        std::ostringstream out;
+        out << std::hex << std::setw(16) << std::setfill('0') << hash;
+        return out.str();
+    }
+
+    inline std::string hashString(const std::string& text)
+    {
+        return hexHash(fnv1a(text.data(), text.size()));
+    }
+
+    // Hash of the file contents, read in 1 MiB blocks.
+    inline std::string hashFile(const std::filesystem::path& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Cannot read " + path.string());
+        std::vector<char> block(1 << 20);
+        std::uint64_t     hash = fnv1a(nullptr, 0);
+        while (in) {
+            in.read(block.data(), block.size());
+            hash = fnv1a(block.data(), static_cast<std::size_t>(in.gcount()), hash);
+        }
+        return hexHash(hash);
+    }
+
+    /**
+     * @brief Record of what a batch run produced, kept in the output directory
+     *
+     * Per subject: hash of the fixed and moving inputs, hash of the parameters, tool version
+     * and output paths. A subject is up to date when all of these match the current run and
+     * every output still exists.
+     *
+     * File hashes are cached with the file size and modification time, so unchanged inputs are
+     * not read again on the next run. All methods are thread-safe; record() rewrites the
+     * manifest through a temporary file and rename(), so a crash never leaves it truncated.
+     *
+     * Worker processes sharing the directory each write their own `manifest.<worker>.tsv`
+     * (a single process writes `manifest.tsv`). Every manifest in the directory is read, oldest
+     * file first, so the most recently written record of a subject wins.
+     */
+    class BatchManifest
+    {
+      public:
+        struct Entry
+        {
+            std::string              fixedHash;
+            std::string              movingHash;
+            std::string              paramsHash;
+            std::string              version = ITKEXP_VERSION;
+            std::vector<std::string> outputs;
+        };
+
+        explicit BatchManifest(const std::filesystem::path& directory,
+                               const std::string&           worker = {})
+            : file_(directory / (worker.empty() ? "manifest.tsv" : "manifest." + worker + ".tsv"))
+        {
+            std::vector<std::filesystem::path> manifests;
+            for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+                const auto name = entry.path().filename().string();
+                if (name.starts_with("manifest") && name.ends_with(".tsv"))
+                    manifests.push_back(entry.path());
+            }
+            std::sort(manifests.begin(), manifests.end(), [](const auto& a, const auto& b) {
+                return std::filesystem::last_write_time(a) < std::filesystem::last_write_time(b);
+            });
+            for (const auto& manifest : manifests)
+                load(manifest, manifest == file_);
+        }
+
+        // Content hash of path, reusing the cached value while size and mtime are unchanged.
+        std::string fileHash(const std::filesystem::path& path)
+        {
+            const auto key   = std::filesystem::absolute(path).string();
+            const auto size  = std::filesystem::file_size(path);
+            const auto mtime = static_cast<long long>(
+                std::filesystem::last_write_time(path).time_since_epoch().count());
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto                        it = files_.find(key);
+                if (it != files_.end() && it->second.size == size && it->second.mtime == mtime)
+                    return it->second.hash;
+            }
+            const auto                  hash = hashFile(path);
+            std::lock_guard<std::mutex> lock(mutex_);
+            files_[key] = {size, mtime, hash};
+            return hash;
+        }
+
+        // True when the subject was produced from the same inputs, parameters and version and
+        // its outputs are all still present. The moving image is only hashed when the rest
+        // matches.
+        bool upToDate(const std::string& subject, const std::string& fixedHash,
+                      const std::filesystem::path& moving, const std::string& paramsHash,
+                      const std::vector<std::string>& outputs)
+        {
+            Entry entry;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto                        it = subjects_.find(subject);
+                if (it == subjects_.end())
+                    return false;
+                entry = it->second;
+            }
+            if (entry.fixedHash != fixedHash || entry.paramsHash != paramsHash ||
+                entry.version != ITKEXP_VERSION || entry.outputs != outputs)
+                return false;
+            for (const auto& output : outputs)
+                if (!std::filesystem::exists(output))
+                    return false;
+            return entry.movingHash == fileHash(moving);
+        }
+
+        void record(const std::string& subject, Entry entry)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            subjects_[subject] = entry;
+            own_[subject]      = std::move(entry);
+            save();
+        }
+
+      private:
+        struct FileRecord
+        {
+            std::uintmax_t size  = 0;
+            long long      mtime = 0;
+            std::string    hash;
+        };
+
+        // Line format (tab separated, paths last so they may contain spaces):
+        //   file     <hash> <size> <mtime> <path>
+        //   subject  <fixed hash> <moving hash> <params hash> <version> <name> <output>...
+        void load(const std::filesystem::path& file, bool own)
+        {
+            std::ifstream in(file);
+            std::string   line;
+            while (std::getline(in, line)) {
+                std::vector<std::string> fields;
+                std::istringstream       split(line);
+                for (std::string field; std::getline(split, field, '\t');)
+                    fields.push_back(field);
+
+                if (fields.size() == 5 && fields[0] == "file") {
+                    files_[fields[4]] = {std::stoull(fields[2]), std::stoll(fields[3]),
+                                         fields[1]};
+                } else if (fields.size() >= 6 && fields[0] == "subject") {
+                    Entry entry{fields[1], fields[2], fields[3], fields[4], {}};
+                    entry.outputs.assign(fields.begin() + 6, fields.end());
+                    if (own)
+                        own_[fields[5]] = entry;
+                    subjects_[fields[5]] = std::move(entry);
+                }
+            }
+        }
+
+        void save() const
+        {
+            const auto    temp = file_.string() + ".tmp";
+            std::ofstream out(temp, std::ios::trunc);
+            for (const auto& [path, record] : files_)
+                out << "file\t" << record.hash << '\t' << record.size << '\t' << record.mtime
+                    << '\t' << path << '\n';
+            for (const auto& [subject, entry] : own_) {
+                out << "subject\t" << entry.fixedHash << '\t' << entry.movingHash << '\t'
+                    << entry.paramsHash << '\t' << entry.version << '\t' << subject;
+                for (const auto& output : entry.outputs)
+                    out << '\t' << output;
+                out << '\n';
+            }
+            out.close();
+            if (!out || std::rename(temp.c_str(), file_.string().c_str()) != 0)
+                throw std::runtime_error("Cannot write manifest " + file_.string());
+        }
+
+        const std::filesystem::path       file_;
+        mutable std::mutex                mutex_;
+        std::map<std::string, FileRecord> files_;
+        std::map<std::string, Entry>      subjects_; // merged view of all manifests
+        std::map<std::string, Entry>      own_;      // what this process writes
+    };
+
+}  // namespace itkexp
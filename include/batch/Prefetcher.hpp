@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "io/ImageIO.hpp"
+
+namespace itkexp {
+
+    /**
+     * @brief Reads and decodes upcoming batch inputs on background threads
+     *
+     * Loader threads walk the path list in order and keep at most `depth` decoded images
+     * waiting, holding at most `byteBudget` bytes of pixel data (estimated from the header
+     * before decoding; a single image larger than the budget is admitted when nothing else is
+     * held). take() hands an image over and frees its share of the budget.
+     *
+     * take() never waits on budget: if the requested image is not decoded and no loader is
+     * decoding it yet, it is read synchronously by the caller and the loaders skip it. Jobs
+     * may therefore consume paths in any order without deadlock.
+     */
+    template <typename TImage>
+    class Prefetcher
+    {
+      public:
+        using ImagePointer = typename TImage::Pointer;
+
+        struct Stats
+        {
+            std::size_t hits        = 0; // already decoded when requested
+            std::size_t waits       = 0; // being decoded when requested
+            std::size_t misses      = 0; // read synchronously by the caller
+            double      waitSeconds = 0; // time callers spent blocked in take()
+        };
+
+        Prefetcher(std::vector<std::string> paths, std::size_t depth, std::size_t byteBudget,
+                   unsigned int loaders = 1)
+            : paths_(std::move(paths)), depth_(std::max<std::size_t>(1, depth)),
+              budget_(byteBudget)
+        {
+            for (const auto& path : paths_)
+                entries_[path];
+            for (unsigned int i = 0; i < std::max(1u, loaders); ++i)
+                loaders_.emplace_back([this] { run(); });
+        }
+
+        ~Prefetcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            changed_.notify_all();
+            for (auto& loader : loaders_)
+                loader.join();
+        }
+
+        Prefetcher(const Prefetcher&)            = delete;
+        Prefetcher& operator=(const Prefetcher&) = delete;
+
+        ImagePointer take(const std::string& path)
+        {
+            const auto                   start = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto                         it = entries_.find(path);
+            if (it == entries_.end() || it->second.state == State::Taken)
+                return readNow(path, lock, start);
+
+            Entry& entry = it->second;
+            if (entry.state == State::Queued || entry.state == State::Claimed) {
+                // Not decoding yet (possibly waiting for budget): take it over
+                entry.state = State::Taken;
+                return readNow(path, lock, start);
+            }
+
+            if (entry.state == State::Loading) {
+                ++stats_.waits;
+                changed_.wait(lock, [&entry] { return entry.state == State::Ready; });
+            } else {
+                ++stats_.hits;
+            }
+
+            entry.state        = State::Taken;
+            ImagePointer image = std::move(entry.image);
+            auto         error = entry.error;
+            --held_;
+            heldBytes_ -= entry.bytes;
+            stats_.waitSeconds += secondsSince(start);
+            lock.unlock();
+            changed_.notify_all();
+
+            if (error)
+                std::rethrow_exception(error);
+            return image;
+        }
+
+        // The caller will never take() path (e.g. another worker processes it): keep the
+        // loaders from reading it, or free it if already read.
+        void discard(const std::string& path)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto                         it = entries_.find(path);
+            if (it == entries_.end() || it->second.state == State::Taken)
+                return;
+
+            Entry& entry = it->second;
+            if (entry.state == State::Loading)
+                changed_.wait(lock, [&entry] { return entry.state == State::Ready; });
+            if (entry.state == State::Ready) {
+                entry.image = nullptr;
+                --held_;
+                heldBytes_ -= entry.bytes;
+            }
+            entry.state = State::Taken;
+            lock.unlock();
+            changed_.notify_all();
+        }
+
+        Stats stats() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return stats_;
+        }
+
+      private:
+        enum class State
+        {
+            Queued,  // not reached by a loader
+            Claimed, // a loader read the header and waits for budget
+            Loading, // being decoded
+            Ready,   // decoded (or failed), waiting for take()
+            Taken    // handed over, or read by the caller
+        };
+
+        struct Entry
+        {
+            State              state = State::Queued;
+            ImagePointer       image;
+            std::size_t        bytes = 0;
+            std::exception_ptr error;
+        };
+
+        static double secondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                .count();
+        }
+
+        // Through ImageIO, so block-gzip inputs are inflated in parallel and the mapped cache
+        // (ITKEXP_CACHE_DIR) serves repeated runs
+        static ImagePointer read(const std::string& path)
+        {
+            return ImageIO<typename TImage::PixelType, TImage::ImageDimension>::readImage(path);
+        }
+
+        ImagePointer readNow(const std::string& path, std::unique_lock<std::mutex>& lock,
+                             std::chrono::steady_clock::time_point start)
+        {
+            ++stats_.misses;
+            lock.unlock();
+            auto image = read(path);
+            lock.lock();
+            stats_.waitSeconds += secondsSince(start);
+            return image;
+        }
+
+        static std::size_t estimateBytes(const std::string& path)
+        {
+            return readImageInformation(path).voxelCount() *
+                   sizeof(typename TImage::PixelType);
+        }
+
+        void run()
+        {
+            for (;;) {
+                std::string path;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    while (next_ < paths_.size() &&
+                           entries_[paths_[next_]].state != State::Queued)
+                        ++next_;
+                    if (stop_ || next_ == paths_.size())
+                        return;
+                    path = paths_[next_++];
+                    entries_[path].state = State::Claimed;
+                }
+
+                std::size_t bytes = 0;
+                try {
+                    bytes = estimateBytes(path);
+                } catch (...) {
+                    // Leave unreadable headers to take(), which reports the error
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    Entry&                       entry = entries_[path];
+                    changed_.wait(lock, [&] {
+                        return stop_ || entry.state != State::Claimed ||
+                               (held_ < depth_ && (held_ == 0 || heldBytes_ + bytes <= budget_));
+                    });
+                    if (stop_)
+                        return;
+                    if (entry.state != State::Claimed)
+                        continue; // taken over by a caller
+                    entry.state = State::Loading;
+                    entry.bytes = bytes;
+                    ++held_;
+                    heldBytes_ += bytes;
+                }
+
+                ImagePointer       image;
+                std::exception_ptr error;
+                try {
+                    image = read(path);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    Entry&                      entry = entries_[path];
+                    entry.image                       = std::move(image);
+                    entry.error                       = error;
+                    entry.state                       = State::Ready;
+                }
+                changed_.notify_all();
+            }
+        }
+
+        const std::vector<std::string>         paths_;
+        const std::size_t                      depth_;
+        const std::size_t                      budget_;
+        std::unordered_map<std::string, Entry> entries_;
+        std::size_t                            next_      = 0;
+        std::size_t                            held_      = 0; // Loading + Ready
+        std::size_t                            heldBytes_ = 0;
+        Stats                                  stats_;
+        bool                                   stop_ = false;
+        mutable std::mutex                     mutex_;
+        std::condition_variable                changed_;
+        std::vector<std::thread>               loaders_;
+    };
+
+}  // namespace itkexp
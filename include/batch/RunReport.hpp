@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "registration/MultiResolution.hpp"
+
+namespace itkexp {
+
+    // What happened to one subject of a batch run. Times are wall seconds; stages that did not
+    // run stay at zero.
+    struct SubjectReport
+    {
+        std::string       subject;
+        std::string       status = "ok"; // ok, failed: <reason>, up-to-date, claimed-elsewhere
+        std::string       worker;
+        double            admissionSeconds = 0; // waiting for --mem-budget
+        double            readSeconds      = 0; // moving image (prefetch wait or inline read)
+        double            affineSeconds    = 0;
+        double            bsplineSeconds   = 0;
+        double            demonsSeconds    = 0;
+        double            resampleSeconds  = 0; // all engines' outputs
+        double            writeSeconds     = 0; // on the writer thread, overlapping later jobs
+        double            totalSeconds     = 0; // job start to last registered image
+        double            estimateMiB      = 0;
+        RegistrationStats affine;
+        RegistrationStats bspline;
+        RegistrationStats demons;
+
+        bool processed() const { return status != "up-to-date" && status != "claimed-elsewhere"; }
+    };
+
+    // Nearest-rank percentile (p in [0, 100]); 0 for an empty list.
+    inline double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+            return 0.0;
+        const auto rank = static_cast<std::size_t>(
+            std::ceil(p / 100.0 * values.size()));
+        const auto k = std::clamp<std::size_t>(rank, 1, values.size()) - 1;
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+
+    inline std::string jsonString(const std::string& text)
+    {
+        std::string out = "\"";
+        for (const unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+        return out + "\"";
+    }
+
+    /**
+     * @brief Write a batch run report as JSON
+     *
+     * `subjects` lists every subject with its per-stage times, iterations, final metrics and
+     * status. `summary` gives counts, wall time, throughput over the processed subjects and
+     * p50/p95 of each stage time over the subjects that completed.
+     */
+    inline void writeRunReport(const std::filesystem::path& path,
+                               const std::vector<SubjectReport>& reports, double wallSeconds,
+                               double peakRssMiB, const std::string& version)
+    {
+        const auto    temp = path.string() + ".tmp";
+        std::ofstream out(temp, std::ios::trunc);
+        auto stats = [&out](const char* name, const RegistrationStats& s) {
+            out << ", \"" << name << "_iterations\": " << s.iterations << ", \"" << name
+                << "_metric\": " << (std::isfinite(s.metric) ? s.metric : 0.0);
+        };
+
+        out << "{\n  \"version\": " << jsonString(version) << ",\n  \"subjects\": [";
+        std::size_t processed = 0, ok = 0;
+        for (std::size_t i = 0; i < reports.size(); ++i) {
+            const auto& r = reports[i];
+            processed += r.processed();
+            ok += r.status == "ok";
+            out << (i ? ",\n" : "\n") << "    {\"subject\": " << jsonString(r.subject)
+                << ", \"status\": " << jsonString(r.status)
+                << ", \"worker\": " << jsonString(r.worker)
+                << ", \"admission_s\": " << r.admissionSeconds << ", \"read_s\": " << r.readSeconds
+                << ", \"affine_s\": " << r.affineSeconds << ", \"bspline_s\": " << r.bsplineSeconds
+                << ", \"demons_s\": " << r.demonsSeconds << ", \"resample_s\": "
+                << r.resampleSeconds << ", \"write_s\": " << r.writeSeconds
+                << ", \"total_s\": " << r.totalSeconds << ", \"estimate_mib\": " << r.estimateMiB;
+            stats("affine", r.affine);
+            stats("bspline", r.bspline);
+            stats("demons", r.demons);
+            out << "}";
+        }
+
+        out << "\n  ],\n  \"summary\": {\"subjects\": " << reports.size()
+            << ", \"processed\": " << processed << ", \"ok\": " << ok
+            << ", \"failed\": " << processed - ok << ", \"wall_s\": " << wallSeconds
+            << ", \"subjects_per_hour\": " << 3600.0 * processed / std::max(wallSeconds, 1e-9)
+            << ", \"peak_rss_mib\": " << peakRssMiB;
+        auto latency = [&](const char* name, double SubjectReport::*field) {
+            std::vector<double> values;
+            for (const auto& r : reports)
+                if (r.status == "ok")
+                    values.push_back(r.*field);
+            out << ", \"" << name << "_p50\": " << percentile(values, 50) << ", \"" << name
+                << "_p95\": " << percentile(values, 95);
+        };
+        latency("total_s", &SubjectReport::totalSeconds);
+        latency("read_s", &SubjectReport::readSeconds);
+        latency("affine_s", &SubjectReport::affineSeconds);
+        latency("bspline_s", &SubjectReport::bsplineSeconds);
+        latency("demons_s", &SubjectReport::demonsSeconds);
+        latency("resample_s", &SubjectReport::resampleSeconds);
+        latency("write_s", &SubjectReport::writeSeconds);
+        out << "}\n}\n";
+        out.close();
+        if (!out || std::rename(temp.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("Cannot write report " + path.string());
+    }
+
+}  // namespace itkexp
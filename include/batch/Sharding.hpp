@@ -0,0 +1,290 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "batch/JobScheduler.hpp"
+#include "batch/Manifest.hpp"
+
+namespace itkexp {
+
+    // Static partition of a file list: shard `index` of `count`.
+    struct Shard
+    {
+        unsigned int index = 0;
+        unsigned int count = 1;
+    };
+
+    // "i/N" with 0 <= i < N.
+    inline Shard parseShard(const std::string& text)
+    {
+        Shard shard;
+        if (std::sscanf(text.c_str(), "%u/%u", &shard.index, &shard.count) != 2 ||
+            shard.count == 0 || shard.index >= shard.count)
+            throw std::invalid_argument("Invalid shard '" + text + "', expected i/N with i < N");
+        return shard;
+    }
+
+    // A subject belongs to a shard by the hash of its name, so every worker computes the same
+    // partition without coordination, and adding subjects does not move the existing ones.
+    inline bool inShard(const std::string& subject, const Shard& shard)
+    {
+        return fnv1a(subject.data(), subject.size()) % shard.count == shard.index;
+    }
+
+    // hostname-pid, unique among the processes sharing an output directory.
+    inline std::string defaultWorkerId()
+    {
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        return std::string(host) + "-" + std::to_string(getpid());
+    }
+
+    /**
+     * @brief Subject claims shared by worker processes through lock files in one directory
+     *
+     * A worker owns `<subject>.lock` when it created it with O_CREAT|O_EXCL, which is atomic on
+     * local filesystems and on NFSv3+. While a claim is held, a heartbeat thread refreshes the
+     * lock's mtime; a lock not refreshed for `staleSeconds` belonged to a dead worker and is
+     * removed by the next worker that wants the subject (serialized by a `.recover` lock of
+     * its own). Clocks of the nodes must agree to well within `staleSeconds`.
+     *
+     * complete() leaves `<subject>.done` holding a stamp of the inputs and parameters, so a
+     * subject is only considered done for the same stamp and a changed rerun claims it again.
+     */
+    class ClaimDirectory
+    {
+      public:
+        ClaimDirectory(std::filesystem::path dir, std::string worker, double staleSeconds = 600)
+            : dir_(std::move(dir)), worker_(std::move(worker)), staleSeconds_(staleSeconds)
+        {
+            std::filesystem::create_directories(dir_);
+            heartbeat_ = std::thread([this] { beat(); });
+        }
+
+        ~ClaimDirectory()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wakeup_.notify_all();
+            heartbeat_.join();
+            for (const auto& subject : held_)
+                unlink(lockPath(subject).c_str());
+        }
+
+        ClaimDirectory(const ClaimDirectory&)            = delete;
+        ClaimDirectory& operator=(const ClaimDirectory&) = delete;
+
+        // True when this worker now owns the subject. False when it is done for this stamp or
+        // claimed by a live worker.
+        bool tryClaim(const std::string& subject, const std::string& stamp)
+        {
+            if (readFile(donePath(subject)) == stamp)
+                return false;
+            if (!createExclusive(lockPath(subject), worker_)) {
+                if (!recoverStale(subject) || !createExclusive(lockPath(subject), worker_))
+                    return false;
+            }
+            if (readFile(donePath(subject)) == stamp) { // finished while we were claiming
+                unlink(lockPath(subject).c_str());
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            held_.insert(subject);
+            return true;
+        }
+
+        // Mark the subject done for stamp and drop the claim.
+        void complete(const std::string& subject, const std::string& stamp)
+        {
+            const auto    temp = donePath(subject).string() + "." + worker_;
+            std::ofstream(temp, std::ios::trunc) << stamp;
+            std::rename(temp.c_str(), donePath(subject).c_str());
+            release(subject);
+        }
+
+        // Drop the claim without marking the subject done (another worker may retry it).
+        void release(const std::string& subject)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                held_.erase(subject);
+            }
+            unlink(lockPath(subject).c_str());
+        }
+
+      private:
+        std::filesystem::path lockPath(const std::string& s) const { return dir_ / (s + ".lock"); }
+        std::filesystem::path donePath(const std::string& s) const { return dir_ / (s + ".done"); }
+
+        static std::string readFile(const std::filesystem::path& path)
+        {
+            std::ifstream in(path);
+            return std::string(std::istreambuf_iterator<char>(in), {});
+        }
+
+        static bool createExclusive(const std::filesystem::path& path, const std::string& text)
+        {
+            const int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+            if (fd < 0) {
+                if (errno != EEXIST)
+                    throw std::runtime_error("Cannot create " + path.string());
+                return false;
+            }
+            const bool ok = write(fd, text.data(), text.size()) ==
+                            static_cast<ssize_t>(text.size());
+            close(fd);
+            if (!ok) { // do not leave an empty or truncated lock that blocks the subject
+                unlink(path.c_str());
+                throw std::runtime_error("Cannot write " + path.string());
+            }
+            return true;
+        }
+
+        // Seconds since the file was last modified, or -1 when it does not exist.
+        static double ageSeconds(const std::filesystem::path& path)
+        {
+            struct stat info{};
+            if (stat(path.c_str(), &info) != 0)
+                return -1;
+            const double modified = info.st_mtim.tv_sec + info.st_mtim.tv_nsec * 1e-9;
+            const double now      = std::chrono::duration<double>(
+                                   std::chrono::system_clock::now().time_since_epoch())
+                                   .count();
+            return now - modified;
+        }
+
+        // Remove the subject's lock if it is stale. Returns true when the lock is gone.
+        bool recoverStale(const std::string& subject)
+        {
+            const auto lock    = lockPath(subject);
+            const auto recover = dir_ / (subject + ".recover");
+            const auto age     = ageSeconds(lock);
+            if (age >= 0 && age < staleSeconds_)
+                return false;
+            if (ageSeconds(recover) >= staleSeconds_) // a worker died while recovering
+                unlink(recover.c_str());
+            if (!createExclusive(recover, worker_))
+                return false;
+
+            // Re-check under the recovery lock: the holder may have refreshed it meanwhile
+            const auto recheck = ageSeconds(lock);
+            const bool stale   = recheck < 0 || recheck >= staleSeconds_;
+            if (recheck >= staleSeconds_) {
+                const auto moved = lock.string() + ".stale." + worker_;
+                if (std::rename(lock.c_str(), moved.c_str()) == 0)
+                    unlink(moved.c_str());
+                logLine("♻️ Recovered stale claim on " + subject + " (" +
+                        std::to_string(static_cast<long>(recheck)) + " s old)");
+            }
+            unlink(recover.c_str());
+            return stale;
+        }
+
+        void beat()
+        {
+            const auto period = std::chrono::duration<double>(std::max(1.0, staleSeconds_ / 4));
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!wakeup_.wait_for(lock, period, [this] { return stop_; })) {
+                for (const auto& subject : held_)
+                    utimensat(AT_FDCWD, lockPath(subject).c_str(), nullptr, 0);
+            }
+        }
+
+        const std::filesystem::path dir_;
+        const std::string           worker_;
+        const double                staleSeconds_;
+        std::set<std::string>       held_;
+        bool                        stop_ = false;
+        std::mutex                  mutex_;
+        std::condition_variable     wakeup_;
+        std::thread                 heartbeat_; // last: starts after the members above
+    };
+
+    // Merge per-worker CSV logs (same header) into one CSV. A row replaces an earlier row with
+    // the same first keyColumns fields; logs are read oldest first, so the latest result of a
+    // subject wins. Workers merge one at a time under a POSIX lock on `<output>.lock` (honoured
+    // over NFS), so a merge that read the logs early cannot replace the table of a later one;
+    // the worker finishing last leaves every row. Written through a temporary file and rename().
+    inline std::size_t mergeCsvLogs(const std::filesystem::path& logDir,
+                                    const std::filesystem::path& output, std::size_t keyColumns)
+    {
+        const auto lockPath = output.string() + ".lock";
+        const int  lockFd   = open(lockPath.c_str(), O_CREAT | O_RDWR, 0644);
+        if (lockFd < 0)
+            throw std::runtime_error("Cannot create " + lockPath);
+        struct flock whole{};
+        whole.l_type   = F_WRLCK;
+        whole.l_whence = SEEK_SET;
+        while (fcntl(lockFd, F_SETLKW, &whole) != 0) {
+            if (errno != EINTR) {
+                close(lockFd);
+                throw std::runtime_error("Cannot lock " + lockPath);
+            }
+        }
+        struct Unlock
+        {
+            int fd;
+            ~Unlock() { close(fd); } // closing drops the lock
+        } unlock{lockFd};
+
+        std::vector<std::filesystem::path> logs;
+        if (std::filesystem::is_directory(logDir))
+            for (const auto& entry : std::filesystem::directory_iterator(logDir))
+                if (entry.path().extension() == ".csv")
+                    logs.push_back(entry.path());
+        std::sort(logs.begin(), logs.end(), [](const auto& a, const auto& b) {
+            return std::filesystem::last_write_time(a) < std::filesystem::last_write_time(b);
+        });
+
+        std::string                        header;
+        std::vector<std::string>           order;
+        std::map<std::string, std::string> rows;
+        for (const auto& log : logs) {
+            std::ifstream in(log);
+            std::string   line;
+            if (!std::getline(in, line))
+                continue;
+            header = line;
+            while (std::getline(in, line)) {
+                std::size_t end = 0;
+                for (std::size_t k = 0; k < keyColumns && end != std::string::npos; ++k)
+                    end = line.find(',', end ? end + 1 : 0);
+                const auto key = line.substr(0, end);
+                if (!rows.count(key))
+                    order.push_back(key);
+                rows[key] = line;
+            }
+        }
+
+        const auto    temp = output.string() + ".tmp." + std::to_string(getpid());
+        std::ofstream out(temp, std::ios::trunc);
+        out << header << '\n';
+        for (const auto& key : order)
+            out << rows[key] << '\n';
+        out.close();
+        if (!out || std::rename(temp.c_str(), output.c_str()) != 0)
+            throw std::runtime_error("Cannot write " + output.string());
+        return order.size();
+    }
+
+}  // namespace itkexp
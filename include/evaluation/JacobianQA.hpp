@@ -0,0 +1,111 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "itkCompositeTransform.h"
+#include "itkDisplacementFieldJacobianDeterminantFilter.h"
+#include "itkImage.h"
+#include "itkTransformFileReader.h"
+#include "registration/DisplacementField.hpp"
+
+namespace itkexp {
+
+    // Summary of a Jacobian-determinant map. det <= 0 means the deformation folds (the local
+    // orientation flips), so foldingPercent should be 0 for a usable registration.
+    struct JacobianStats
+    {
+        double min            = 0.0;
+        double p01            = 0.0;
+        double p50            = 0.0;
+        double p99            = 0.0;
+        double max            = 0.0;
+        double foldingPercent = 0.0;
+    };
+
+    template <unsigned int Dim>
+    using JacobianImageType = itk::Image<float, Dim>;
+
+    // Jacobian determinant of x -> x + u(x) at every voxel of the field, with derivatives in
+    // physical units. The filter is split into slabs along the slowest axis (the ITK default
+    // splitter) and runs on all ITK threads.
+    template <unsigned int Dim>
+    typename JacobianImageType<Dim>::Pointer
+    jacobianDeterminant(const typename DisplacementFieldType<Dim>::Pointer& field)
+    {
+        using FilterType =
+            itk::DisplacementFieldJacobianDeterminantFilter<DisplacementFieldType<Dim>, float,
+                                                            JacobianImageType<Dim>>;
+        auto filter = FilterType::New();
+        filter->SetInput(field);
+        filter->SetUseImageSpacingOn();
+        filter->Update();
+        return filter->GetOutput();
+    }
+
+    template <unsigned int Dim>
+    JacobianStats jacobianStats(const typename JacobianImageType<Dim>::Pointer& det)
+    {
+        if (!det)
+            throw std::invalid_argument("jacobianStats: null image");
+
+        const auto*       buffer = det->GetBufferPointer();
+        const std::size_t n      = det->GetBufferedRegion().GetNumberOfPixels();
+        if (n == 0)
+            return {};
+
+        std::vector<float> values(buffer, buffer + n);
+        JacobianStats      stats;
+        const auto [lo, hi] = std::minmax_element(values.begin(), values.end());
+        stats.min           = *lo;
+        stats.max           = *hi;
+        const auto folded =
+            std::count_if(values.begin(), values.end(), [](float v) { return v <= 0.f; });
+        stats.foldingPercent = 100.0 * folded / n;
+
+        // Order statistics by selection: three partial partitions instead of a full sort
+        auto percentile = [&](double q) {
+            auto nth = values.begin() + static_cast<std::ptrdiff_t>(std::floor(q * (n - 1)));
+            std::nth_element(values.begin(), nth, values.end());
+            return static_cast<double>(*nth);
+        };
+        stats.p01 = percentile(0.01);
+        stats.p50 = percentile(0.50);
+        stats.p99 = percentile(0.99);
+        return stats;
+    }
+
+    // Read a transform file (.tfm/.h5) and sample it into a displacement field on the reference
+    // grid. A CompositeTransform is used as is; a plain list of transforms is composed like one,
+    // i.e. the last transform listed is applied first.
+    template <typename TImage>
+    typename DisplacementFieldType<TImage::ImageDimension>::Pointer
+    displacementFieldFromTransformFile(const std::string& path, const TImage* reference)
+    {
+        constexpr unsigned int Dim = TImage::ImageDimension;
+        using CompositeType        = itk::CompositeTransform<double, Dim>;
+        using TransformType        = itk::Transform<double, Dim, Dim>;
+
+        auto reader = itk::TransformFileReaderTemplate<double>::New();
+        reader->SetFileName(path);
+        reader->Update();
+
+        const auto* list = reader->GetTransformList();
+        if (list->empty())
+            throw std::runtime_error("No transform in " + path);
+        if (auto* stored = dynamic_cast<CompositeType*>(list->front().GetPointer()))
+            return computeDisplacementField<TImage>(stored, reference);
+
+        auto composite = CompositeType::New();
+        for (const auto& base : *list) {
+            auto* transform = dynamic_cast<TransformType*>(base.GetPointer());
+            if (!transform)
+                throw std::runtime_error("Unsupported transform in " + path);
+            composite->AddTransform(transform);
+        }
+        return computeDisplacementField<TImage>(composite, reference);
+    }
+
+}  // namespace itkexp
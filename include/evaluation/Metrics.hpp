@@ -9,18 +9,18 @@
 
 namespace itkexp {
 
-    // Mean Squared Error between two same-sized images
-    template <typename TImage>
-    double computeMSE(const typename TImage::Pointer& a, const typename TImage::Pointer& b)
+    // Mean Squared Error between two same-sized images. The second image may have another
+    // pixel type (e.g. a uint16 scan against a float registration result).
+    template <typename TImage, typename TOtherImage = TImage>
+    double computeMSE(const TImage* a, const std::type_identity_t<TOtherImage>* b)
     {
         if (!a || !b)
             throw std::invalid_argument("computeMSE: null image");
         if (a->GetLargestPossibleRegion().GetSize() != b->GetLargestPossibleRegion().GetSize())
             throw std::runtime_error("computeMSE: images must have same size");
 
-        using Iterator = itk::ImageRegionConstIterator<TImage>;
-        Iterator itA(a, a->GetLargestPossibleRegion());
-        Iterator itB(b, b->GetLargestPossibleRegion());
+        itk::ImageRegionConstIterator<TImage>      itA(a, a->GetLargestPossibleRegion());
+        itk::ImageRegionConstIterator<TOtherImage> itB(b, b->GetLargestPossibleRegion());
 
         long double sum = 0.0;
         size_t      n   = 0;
@@ -33,18 +33,18 @@ namespace itkexp {
         return n ? static_cast<double>(sum / n) : 0.0;
     }
 
-    // Normalized Cross-Correlation (Pearson correlation coefficient)
-    template <typename TImage>
-    double computeNCC(const typename TImage::Pointer& a, const typename TImage::Pointer& b)
+    // Normalized Cross-Correlation (Pearson correlation coefficient). The second image may have
+    // another pixel type (e.g. a uint16 scan against a float registration result).
+    template <typename TImage, typename TOtherImage = TImage>
+    double computeNCC(const TImage* a, const std::type_identity_t<TOtherImage>* b)
     {
         if (!a || !b)
             throw std::invalid_argument("computeNCC: null image");
         if (a->GetLargestPossibleRegion().GetSize() != b->GetLargestPossibleRegion().GetSize())
             throw std::runtime_error("computeNCC: images must have same size");
 
-        using Iterator = itk::ImageRegionConstIterator<TImage>;
-        Iterator itA(a, a->GetLargestPossibleRegion());
-        Iterator itB(b, b->GetLargestPossibleRegion());
+        itk::ImageRegionConstIterator<TImage>      itA(a, a->GetLargestPossibleRegion());
+        itk::ImageRegionConstIterator<TOtherImage> itB(b, b->GetLargestPossibleRegion());
 
         long double sumA = 0.0, sumB = 0.0, sumAA = 0.0, sumBB = 0.0, sumAB = 0.0;
         size_t      n = 0;
@@ -74,8 +74,7 @@ namespace itkexp {
     // Dice coefficient for label maps (same size). Labels are treated as multi-label.
     // Returns Dice for foreground union of all labels; for per-label, use ITK filter directly.
     template <typename TLabelImage>
-    double computeDice(const typename TLabelImage::Pointer& gt,
-                       const typename TLabelImage::Pointer& pred)
+    double computeDice(const TLabelImage* gt, const TLabelImage* pred)
     {
         if (!gt || !pred)
             throw std::invalid_argument("computeDice: null image");
@@ -0,0 +1,122 @@
+#pragma once
+#include <itkImageFileWriter.h>
+
+#include "io/ParallelGzip.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace itkexp {
+
+// Writes images on one background thread so the caller can keep computing while compression
+// and disk I/O run. Each write returns a std::future<double>; get() gives the seconds the write
+// took, or rethrows any exception raised while writing. At most maxPending writes, and with
+// maxBytes > 0 at most maxBytes of pixel data, are queued or in progress, which bounds the
+// memory held by finished images kept alive only for writing; write() blocks when the queue is
+// full. A single image larger than maxBytes is still accepted once the queue is empty.
+// The destructor finishes every queued write before returning.
+class AsyncWriter {
+public:
+    explicit AsyncWriter(std::size_t maxPending = 2, std::size_t maxBytes = 0)
+        : m_maxPending(maxPending ? maxPending : 1), m_maxBytes(maxBytes),
+          m_worker([this] { run(); }) {}
+
+    ~AsyncWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_ready.notify_all();
+        m_worker.join();
+    }
+
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // The image is shared with the writer thread and must not be modified until the future
+    // is ready. The future holds the duration of the write.
+    template <typename TImage>
+    std::future<double> write(const itk::SmartPointer<TImage>& image, const std::string& path) {
+        std::packaged_task<double()> timed([image, path] {
+            const auto start = std::chrono::steady_clock::now();
+            writeImageFile<TImage>(image.GetPointer(), path);
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+        auto future = timed.get_future();
+        std::packaged_task<void()> task([timed = std::move(timed)]() mutable { timed(); });
+        const std::size_t bytes =
+            image->GetBufferedRegion().GetNumberOfPixels() * sizeof(typename TImage::PixelType);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space.wait(lock, [this, bytes] {
+            return m_pending == 0 || (m_pending < m_maxPending &&
+                                      (!m_maxBytes || m_pendingBytes + bytes <= m_maxBytes));
+        });
+        ++m_pending;
+        m_pendingBytes += bytes;
+        m_queue.emplace_back(std::move(task), bytes);
+        lock.unlock();
+        m_ready.notify_one();
+        return future;
+    }
+
+    // Runs fn on the writer thread once every write queued before it has finished, e.g. to
+    // record outputs only after they are on disk. Never blocks the caller.
+    std::future<void> post(std::function<void()> fn) {
+        std::packaged_task<void()> task(std::move(fn));
+        auto future = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_pending;
+            m_queue.emplace_back(std::move(task), 0);
+        }
+        m_ready.notify_one();
+        return future;
+    }
+
+private:
+    using Entry = std::pair<std::packaged_task<void()>, std::size_t>;
+
+    void run() {
+        for (;;) {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_ready.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                if (m_queue.empty())
+                    return; // stopped and drained
+                entry = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            entry.first(); // exceptions are stored in the future
+            entry.first = {}; // drop the task and with it the last reference to the image
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_pending;
+                m_pendingBytes -= entry.second;
+            }
+            m_space.notify_all();
+        }
+    }
+
+    const std::size_t       m_maxPending;
+    const std::size_t       m_maxBytes;
+    std::mutex              m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_space;
+    std::deque<Entry>       m_queue;
+    std::size_t             m_pending = 0;      // queued or being written
+    std::size_t             m_pendingBytes = 0;
+    bool                    m_stop = false;
+    std::thread             m_worker; // last: starts after the members above
+};
+
+} // namespace itkexp
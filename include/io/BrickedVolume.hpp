@@ -0,0 +1,402 @@
+#pragma once
+#include <itkImage.h>
+#include <itk_zlib.h>
+
+#include "io/MappedCache.hpp"
+#include "io/ParallelGzip.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace itkexp {
+
+// Bricked volume (.ixb): the image is cut into BrickEdge^N bricks, each zlib-compressed on
+// its own, so bricks are encoded and decoded in parallel and a region read inflates only the
+// bricks it intersects. Layout, native little-endian:
+//   BrickedHeader | BrickEntry[brickCount] | compressed bricks
+// Bricks are numbered x fastest over the brick grid. Each holds its voxels (clipped at the
+// volume edge) x fastest, in the pixel type named by pixelTag.
+inline constexpr unsigned int BrickEdge = 64;
+inline constexpr unsigned int BrickedMaxDimension = 4;
+
+struct BrickedHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t dimension;
+    char pixelTag[8];
+    std::uint32_t brickEdge;
+    std::uint32_t reserved;
+    std::uint64_t size[BrickedMaxDimension];
+    double spacing[BrickedMaxDimension];
+    double origin[BrickedMaxDimension];
+    double direction[BrickedMaxDimension * BrickedMaxDimension];
+    std::uint64_t brickCount;
+};
+
+struct BrickEntry {
+    std::uint64_t offset; // from the start of the file
+    std::uint64_t bytes;  // compressed
+};
+
+static_assert(std::is_trivially_copyable_v<BrickedHeader>);
+static_assert(std::is_trivially_copyable_v<BrickEntry>);
+
+inline bool isBricked(const std::filesystem::path& path) {
+    return path.extension() == ".ixb";
+}
+
+namespace detail {
+
+template <typename... Ts, typename Fn>
+bool visitPixelTagOf(const std::string& tag, Fn& fn) {
+    return ((tag == mappedPixelTag<Ts>() ? (fn.template operator()<Ts>(), true) : false) || ...);
+}
+
+// Calls fn.template operator()<T>() with the scalar type named by a mappedPixelTag.
+template <typename Fn>
+void visitPixelTag(const std::string& tag, Fn&& fn) {
+    if (!visitPixelTagOf<float, double, std::uint8_t, std::int8_t, std::uint16_t, std::int16_t,
+                         std::uint32_t, std::int32_t, std::uint64_t, std::int64_t>(tag, fn)) {
+        throw std::runtime_error(std::format("Unknown pixel type '{}'", tag));
+    }
+}
+
+// Brick grid of a header: which voxels brick b covers.
+struct BrickGrid {
+    explicit BrickGrid(const BrickedHeader& header)
+        : dimension(header.dimension), edge(header.brickEdge) {
+        for (unsigned int d = 0; d < dimension; ++d) {
+            size[d] = header.size[d];
+            bricks[d] = (size[d] + edge - 1) / edge;
+            total *= bricks[d];
+        }
+    }
+
+    std::uint64_t index(const std::uint64_t* brick) const {
+        std::uint64_t b = 0;
+        for (unsigned int d = dimension; d-- > 0;) {
+            b = b * bricks[d] + brick[d];
+        }
+        return b;
+    }
+
+    // First voxel and extent of brick b.
+    void box(std::uint64_t b, std::uint64_t* start, std::uint64_t* extent) const {
+        for (unsigned int d = 0; d < dimension; ++d) {
+            start[d] = (b % bricks[d]) * edge;
+            extent[d] = std::min<std::uint64_t>(edge, size[d] - start[d]);
+            b /= bricks[d];
+        }
+    }
+
+    unsigned int dimension;
+    std::uint64_t edge;
+    std::uint64_t size[BrickedMaxDimension] = {};
+    std::uint64_t bricks[BrickedMaxDimension] = {};
+    std::uint64_t total = 1;
+};
+
+// Calls fn(offsetA, offsetB) for every x-row of the box `extent` at `startA` in an array of
+// sizes `sizeA` and at `startB` in one of sizes `sizeB` (linear element offsets, x fastest).
+template <typename Fn>
+void forEachRow(unsigned int dimension, const std::uint64_t* extent, const std::uint64_t* startA,
+                const std::uint64_t* sizeA, const std::uint64_t* startB,
+                const std::uint64_t* sizeB, Fn&& fn) {
+    std::uint64_t rows = 1;
+    for (unsigned int d = 1; d < dimension; ++d) {
+        rows *= extent[d];
+    }
+    for (std::uint64_t r = 0; r < rows; ++r) {
+        std::uint64_t a = 0, b = 0, strideA = 1, strideB = 1, rest = r;
+        for (unsigned int d = 0; d < dimension; ++d) {
+            std::uint64_t c = 0;
+            if (d > 0) {
+                c = rest % extent[d];
+                rest /= extent[d];
+            }
+            a += (startA[d] + c) * strideA;
+            b += (startB[d] + c) * strideB;
+            strideA *= sizeA[d];
+            strideB *= sizeB[d];
+        }
+        fn(a, b);
+    }
+}
+
+// Closes a file descriptor with the object.
+struct FileDescriptor {
+    explicit FileDescriptor(const std::filesystem::path& path) : fd(open(path.c_str(), O_RDONLY)) {}
+    ~FileDescriptor() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int fd;
+};
+
+inline void preadFully(int fd, void* buffer, std::size_t bytes, std::uint64_t offset) {
+    auto* out = static_cast<char*>(buffer);
+    while (bytes > 0) {
+        const ssize_t n = pread(fd, out, bytes, static_cast<off_t>(offset));
+        if (n <= 0) {
+            throw std::runtime_error("Truncated bricked volume");
+        }
+        out += n;
+        bytes -= n;
+        offset += n;
+    }
+}
+
+} // namespace detail
+
+// Header and (optionally) brick index of a bricked volume; nothing is inflated.
+inline BrickedHeader readBrickedHeader(const std::filesystem::path& path,
+                                       std::vector<BrickEntry>* index = nullptr) {
+    detail::FileDescriptor file(path);
+    if (file.fd < 0) {
+        throw std::runtime_error(std::format("Cannot open '{}'", path.string()));
+    }
+    BrickedHeader header;
+    detail::preadFully(file.fd, &header, sizeof(header), 0);
+    if (std::memcmp(header.magic, "ITKXBRK", 8) != 0 || header.version != 1 ||
+        header.dimension == 0 || header.dimension > BrickedMaxDimension ||
+        header.brickEdge == 0 || detail::BrickGrid(header).total != header.brickCount) {
+        throw std::runtime_error(std::format("'{}' is not a bricked volume", path.string()));
+    }
+    if (index) {
+        index->resize(header.brickCount);
+        detail::preadFully(file.fd, index->data(), index->size() * sizeof(BrickEntry),
+                           sizeof(header));
+    }
+    return header;
+}
+
+/**
+ * @brief Write an image as a bricked volume
+ *
+ * Bricks are gathered and compressed on `threads` threads (default gzipThreads()) at zlib
+ * `level` (default gzipLevel()), then written with their index through a temporary file and
+ * rename. The image's buffered region must be its largest possible region.
+ */
+template <typename TImage>
+void writeBricked(const TImage* image, const std::filesystem::path& path, int level = -1,
+                  unsigned int threads = 0) {
+    using PixelType = typename TImage::PixelType;
+    constexpr unsigned int Dimension = TImage::ImageDimension;
+    static_assert(std::is_arithmetic_v<PixelType>, "bricked volumes hold scalar pixels");
+    static_assert(Dimension <= BrickedMaxDimension);
+    if (image->GetBufferedRegion() != image->GetLargestPossibleRegion()) {
+        throw std::invalid_argument("writeBricked needs the whole image in memory");
+    }
+
+    BrickedHeader header{};
+    std::memcpy(header.magic, "ITKXBRK", 8);
+    header.version = 1;
+    header.dimension = Dimension;
+    std::snprintf(header.pixelTag, sizeof(header.pixelTag), "%s",
+                  mappedPixelTag<PixelType>().c_str());
+    header.brickEdge = BrickEdge;
+    const auto size = image->GetLargestPossibleRegion().GetSize();
+    for (unsigned int r = 0; r < Dimension; ++r) {
+        header.size[r] = size[r];
+        header.spacing[r] = image->GetSpacing()[r];
+        header.origin[r] = image->GetOrigin()[r];
+        for (unsigned int c = 0; c < Dimension; ++c) {
+            header.direction[r * Dimension + c] = image->GetDirection()[r][c];
+        }
+    }
+    const detail::BrickGrid grid(header);
+    header.brickCount = grid.total;
+
+    const PixelType* buffer = image->GetBufferPointer();
+    const int zlevel = level < 0 ? gzipLevel() : level;
+    std::vector<std::string> bricks(grid.total);
+    detail::parallelFor(grid.total, threads ? threads : gzipThreads(), [&](std::size_t b) {
+        std::uint64_t start[BrickedMaxDimension], extent[BrickedMaxDimension];
+        std::uint64_t zero[BrickedMaxDimension] = {};
+        grid.box(b, start, extent);
+        std::uint64_t voxels = 1;
+        for (unsigned int d = 0; d < Dimension; ++d) {
+            voxels *= extent[d];
+        }
+        std::vector<PixelType> raw(voxels);
+        detail::forEachRow(Dimension, extent, zero, extent, start, grid.size,
+                           [&](std::uint64_t brickOffset, std::uint64_t imageOffset) {
+                               std::copy_n(buffer + imageOffset, extent[0],
+                                           raw.data() + brickOffset);
+                           });
+
+        const uLong rawBytes = static_cast<uLong>(voxels * sizeof(PixelType));
+        uLongf packed = compressBound(rawBytes);
+        auto& out = bricks[b];
+        out.resize(packed);
+        if (compress2(reinterpret_cast<Bytef*>(out.data()), &packed,
+                      reinterpret_cast<const Bytef*>(raw.data()), rawBytes, zlevel) != Z_OK) {
+            throw std::runtime_error("compress2 failed");
+        }
+        out.resize(packed);
+    });
+
+    std::vector<BrickEntry> index(grid.total);
+    std::uint64_t offset = sizeof(header) + index.size() * sizeof(BrickEntry);
+    for (std::size_t b = 0; b < bricks.size(); ++b) {
+        index[b] = {offset, bricks[b].size()};
+        offset += bricks[b].size();
+    }
+
+    const auto temp = detail::siblingTempName(path);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(index.data()),
+                  static_cast<std::streamsize>(index.size() * sizeof(BrickEntry)));
+        for (const auto& brick : bricks) {
+            out.write(brick.data(), static_cast<std::streamsize>(brick.size()));
+        }
+        if (!out) {
+            throw std::runtime_error(std::format("Cannot write '{}'", path.string()));
+        }
+    }
+    std::filesystem::rename(temp, path);
+}
+
+/**
+ * @brief Read a bricked volume, or only `region` of it
+ *
+ * Only the bricks that intersect the region are read (pread) and inflated, on `threads`
+ * threads (default gzipThreads()). Pixels are converted from the stored type. The result
+ * covers exactly the region, keeping its index, like ImageIO::readRegion.
+ */
+template <typename TImage>
+typename TImage::Pointer readBricked(const std::filesystem::path& path,
+                                     const typename TImage::RegionType* region = nullptr,
+                                     unsigned int threads = 0) {
+    using PixelType = typename TImage::PixelType;
+    constexpr unsigned int Dimension = TImage::ImageDimension;
+
+    std::vector<BrickEntry> index;
+    const BrickedHeader header = readBrickedHeader(path, &index);
+    if (header.dimension != Dimension) {
+        throw std::runtime_error(std::format("'{}' is {}D, expected {}D", path.string(),
+                                             header.dimension, Dimension));
+    }
+    const detail::BrickGrid grid(header);
+
+    typename TImage::RegionType largest;
+    typename TImage::SpacingType spacing;
+    typename TImage::PointType origin;
+    typename TImage::DirectionType direction;
+    for (unsigned int r = 0; r < Dimension; ++r) {
+        largest.SetSize(r, header.size[r]);
+        spacing[r] = header.spacing[r];
+        origin[r] = header.origin[r];
+        for (unsigned int c = 0; c < Dimension; ++c) {
+            direction[r][c] = header.direction[r * Dimension + c];
+        }
+    }
+    const auto wanted = region ? *region : largest;
+    if (!largest.IsInside(wanted)) {
+        throw std::out_of_range(std::format("Region outside of '{}'", path.string()));
+    }
+
+    auto image = TImage::New();
+    image->SetRegions(wanted);
+    image->SetSpacing(spacing);
+    image->SetOrigin(origin);
+    image->SetDirection(direction);
+    image->Allocate();
+    PixelType* buffer = image->GetBufferPointer();
+
+    // Bricks intersecting the region
+    std::uint64_t lo[BrickedMaxDimension] = {}, hi[BrickedMaxDimension] = {};
+    std::uint64_t wantedStart[BrickedMaxDimension] = {}, wantedSize[BrickedMaxDimension] = {};
+    for (unsigned int d = 0; d < Dimension; ++d) {
+        wantedStart[d] = wanted.GetIndex(d);
+        wantedSize[d] = wanted.GetSize(d);
+        lo[d] = wantedStart[d] / grid.edge;
+        hi[d] = (wantedStart[d] + wantedSize[d] - 1) / grid.edge;
+    }
+    std::vector<std::uint64_t> touched;
+    if (wanted.GetNumberOfPixels() > 0) {
+        std::uint64_t brick[BrickedMaxDimension];
+        std::copy_n(lo, Dimension, brick);
+        for (;;) {
+            touched.push_back(grid.index(brick));
+            unsigned int d = 0;
+            while (d < Dimension && ++brick[d] > hi[d]) {
+                brick[d] = lo[d];
+                ++d;
+            }
+            if (d == Dimension) {
+                break;
+            }
+        }
+    }
+
+    detail::FileDescriptor file(path);
+    if (file.fd < 0) {
+        throw std::runtime_error(std::format("Cannot open '{}'", path.string()));
+    }
+    const std::string tag = header.pixelTag;
+    detail::parallelFor(touched.size(), threads ? threads : gzipThreads(), [&](std::size_t t) {
+        const std::uint64_t b = touched[t];
+        std::uint64_t start[BrickedMaxDimension], extent[BrickedMaxDimension];
+        grid.box(b, start, extent);
+
+        std::string packed(index[b].bytes, '\0');
+        detail::preadFully(file.fd, packed.data(), packed.size(), index[b].offset);
+
+        detail::visitPixelTag(tag, [&]<typename TStored>() {
+            std::uint64_t voxels = 1;
+            for (unsigned int d = 0; d < Dimension; ++d) {
+                voxels *= extent[d];
+            }
+            std::vector<TStored> raw(voxels);
+            uLongf rawBytes = static_cast<uLongf>(voxels * sizeof(TStored));
+            if (uncompress(reinterpret_cast<Bytef*>(raw.data()), &rawBytes,
+                           reinterpret_cast<const Bytef*>(packed.data()),
+                           static_cast<uLong>(packed.size())) != Z_OK ||
+                rawBytes != voxels * sizeof(TStored)) {
+                throw std::runtime_error(std::format("Corrupt brick {} in '{}'", b,
+                                                     path.string()));
+            }
+
+            // Intersection of brick and region, relative to each
+            std::uint64_t inBrick[BrickedMaxDimension], inImage[BrickedMaxDimension];
+            std::uint64_t overlap[BrickedMaxDimension];
+            for (unsigned int d = 0; d < Dimension; ++d) {
+                const auto first = std::max(start[d], wantedStart[d]);
+                const auto last = std::min(start[d] + extent[d], wantedStart[d] + wantedSize[d]);
+                inBrick[d] = first - start[d];
+                inImage[d] = first - wantedStart[d];
+                overlap[d] = last - first;
+            }
+            detail::forEachRow(Dimension, overlap, inBrick, extent, inImage, wantedSize,
+                               [&](std::uint64_t brickOffset, std::uint64_t imageOffset) {
+                                   std::transform(raw.data() + brickOffset,
+                                                  raw.data() + brickOffset + overlap[0],
+                                                  buffer + imageOffset, [](TStored v) {
+                                                      return static_cast<PixelType>(v);
+                                                  });
+                               });
+        });
+    });
+    return image;
+}
+
+} // namespace itkexp
@@ -0,0 +1,211 @@
+#pragma once
+#include <itkDataObject.h>
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+
+namespace itkexp {
+
+/**
+ * @brief Process-wide LRU cache of decoded images
+ *
+ * Entries are keyed by canonical path and image type, and remember the file's mtime and size:
+ * a file that changed on disk is read again. Images are handed out as const and shared, so
+ * every holder sees the same pixels; callers that modify an image must copy it first.
+ *
+ * The cache holds at most `byteBudget` bytes of pixel data and evicts the least recently used
+ * images beyond that. An evicted image lives on while someone still holds it. An image larger
+ * than the whole budget is returned but not kept, and a budget of 0 disables caching. Threads
+ * asking for an image that is being read wait for that read instead of starting their own.
+ */
+class ImageCache {
+public:
+    struct Stats {
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+        std::size_t budget = 0;
+    };
+
+    explicit ImageCache(std::size_t byteBudget) : m_budget(byteBudget) {}
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    // Shared cache of the process; budget from ITKEXP_IMAGE_CACHE_MB (default 1024).
+    static ImageCache& instance() {
+        static ImageCache cache([] {
+            const char* env = std::getenv("ITKEXP_IMAGE_CACHE_MB");
+            return std::size_t(env ? std::atoll(env) : 1024) << 20;
+        }());
+        return cache;
+    }
+
+    // Returns the cached image for `filename`, or calls load() (returning TImage::Pointer) and
+    // keeps its result. Exceptions from load() propagate to every waiting caller.
+    template <typename TImage, typename TLoader>
+    typename TImage::ConstPointer get(const std::filesystem::path& filename, TLoader&& load) {
+        using ConstPointer = typename TImage::ConstPointer;
+        std::error_code ec;
+        auto canonical = std::filesystem::weakly_canonical(filename, ec);
+        struct stat st {};
+        if (ec || stat(canonical.c_str(), &st) != 0 || budget() == 0) {
+            count(m_misses);
+            return ConstPointer(load().GetPointer());
+        }
+        const std::int64_t mtimeNs =
+            std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        const std::string key = canonical.string() + '\n' + typeid(TImage).name();
+
+        std::promise<Image> promise;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(key);
+            if (it != m_entries.end() && it->second.mtimeNs == mtimeNs &&
+                it->second.fileBytes == std::uintmax_t(st.st_size)) {
+                ++m_hits;
+                m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+                auto image = it->second.image;
+                lock.unlock();
+                return ConstPointer(static_cast<const TImage*>(image.get().GetPointer()));
+            }
+            ++m_misses;
+            if (it != m_entries.end()) {
+                erase(it);
+            }
+            m_lru.push_front(key);
+            m_entries.emplace(key, Entry{mtimeNs, std::uintmax_t(st.st_size),
+                                         promise.get_future().share(), 0, false, m_lru.begin()});
+        }
+
+        ConstPointer image;
+        try {
+            image = load().GetPointer();
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (auto it = m_entries.find(key); it != m_entries.end() && !it->second.ready) {
+                erase(it);
+            }
+            throw;
+        }
+        promise.set_value(Image(image.GetPointer()));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end() || it->second.ready || it->second.mtimeNs != mtimeNs ||
+            it->second.fileBytes != std::uintmax_t(st.st_size)) {
+            return image;
+        }
+        it->second.bytes = image->GetPixelContainer()->Size() *
+                           sizeof(typename TImage::PixelContainer::Element);
+        it->second.ready = true;
+        m_bytes += it->second.bytes;
+        if (it->second.bytes > m_budget) {
+            erase(it);
+        } else {
+            evict();
+        }
+        return image;
+    }
+
+    void setBudget(std::size_t byteBudget) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = byteBudget;
+        evict();
+    }
+
+    std::size_t budget() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_budget;
+    }
+
+    // Drops every finished entry; images still held elsewhere stay alive.
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            auto next = std::next(it);
+            if (it->second.ready) {
+                erase(it);
+            }
+            it = next;
+        }
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return {m_hits, m_misses, m_evictions, m_entries.size(), m_bytes, m_budget};
+    }
+
+private:
+    using Image = itk::DataObject::ConstPointer;
+
+    struct Entry {
+        std::int64_t mtimeNs;
+        std::uintmax_t fileBytes;
+        std::shared_future<Image> image;
+        std::size_t bytes;
+        bool ready;  // loaded and counted in m_bytes
+        std::list<std::string>::iterator lru;
+    };
+
+    void count(std::size_t& counter) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++counter;
+    }
+
+    void erase(std::unordered_map<std::string, Entry>::iterator it) {
+        if (it->second.ready) {
+            m_bytes -= it->second.bytes;
+        }
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+
+    // Least recently used first; entries still being read are skipped
+    void evict() {
+        auto key = m_lru.end();
+        while (m_bytes > m_budget && key != m_lru.begin()) {
+            auto it = m_entries.find(*std::prev(key));
+            if (!it->second.ready) {
+                --key;
+                continue;
+            }
+            erase(it);
+            ++m_evictions;
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::size_t m_budget;
+    std::size_t m_bytes = 0;
+    std::size_t m_hits = 0;
+    std::size_t m_misses = 0;
+    std::size_t m_evictions = 0;
+    std::list<std::string> m_lru;  // most recently used first
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+// One line: hits, misses, evictions and the pixel data held against the budget.
+inline void printImageCacheStats(const ImageCache::Stats& s, std::ostream& out = std::cout) {
+    out << std::format("🗂️ Image cache: {} hits, {} misses, {} evictions, {:.1f} MB in {} "
+                       "images (budget {:.0f} MB)\n",
+                       s.hits, s.misses, s.evictions, s.bytes / 1e6, s.entries, s.budget / 1e6);
+}
+
+} // namespace itkexp
@@ -1,54 +1,264 @@
 #pragma once
 #include <itkImage.h>
+#include <itkImageAlgorithm.h>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
+#include <itkImageIOFactory.h>
 #include <itkMetaDataDictionary.h>
 
+#include "io/BrickedVolume.hpp"
+#include "io/ImageCache.hpp"
+#include "io/MappedCache.hpp"
+#include "io/ParallelGzip.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <filesystem>
 #include <format>
+#include <type_traits>
+#include <vector>
 
 namespace itkexp {
 
+// Geometry and storage of an image file, as far as its header tells. Direction is stored per
+// axis (direction[d] is the physical direction of index axis d).
+struct ImageInformation {
+    std::filesystem::path path;
+    unsigned int dimension = 0;
+    std::vector<std::size_t> size;
+    std::vector<double> spacing;
+    std::vector<double> origin;
+    std::vector<std::vector<double>> direction;
+    std::string componentType;     // e.g. "short", "float"
+    itk::IOComponentEnum component = itk::IOComponentEnum::UNKNOWNCOMPONENTTYPE;
+    std::string pixelType;         // e.g. "scalar", "vector"
+    unsigned int components = 1;
+    std::size_t componentBytes = 0;
+    std::uintmax_t fileBytes = 0;  // on disk, compressed if the format is
+
+    std::size_t voxelCount() const {
+        std::size_t n = dimension ? 1 : 0;
+        for (auto s : size) n *= s;
+        return n;
+    }
+
+    // Bytes of the decoded pixel data in its native type.
+    std::size_t pixelBytes() const { return voxelCount() * components * componentBytes; }
+
+    // Same voxel grid: size, spacing, origin and direction (to `tolerance`).
+    bool sameGrid(const ImageInformation& other, double tolerance = 1e-4) const {
+        auto close = [tolerance](const std::vector<double>& a, const std::vector<double>& b) {
+            if (a.size() != b.size()) return false;
+            for (std::size_t i = 0; i < a.size(); ++i)
+                if (std::abs(a[i] - b[i]) > tolerance * std::max(1.0, std::abs(a[i])))
+                    return false;
+            return true;
+        };
+        if (dimension != other.dimension || size != other.size) return false;
+        if (!close(spacing, other.spacing) || !close(origin, other.origin)) return false;
+        for (unsigned int d = 0; d < dimension; ++d)
+            if (!close(direction[d], other.direction[d])) return false;
+        return true;
+    }
+};
+
+// Reads only the header of `filename`; no pixel data is decoded. For compressed files this
+// costs one small read instead of inflating the whole volume.
+[[nodiscard]] inline ImageInformation readImageInformation(const std::filesystem::path& filename) {
+    if (isBricked(filename)) {
+        const auto header = readBrickedHeader(filename);
+        ImageInformation info;
+        info.path = filename;
+        info.dimension = header.dimension;
+        for (unsigned int r = 0; r < info.dimension; ++r) {
+            info.size.push_back(header.size[r]);
+            info.spacing.push_back(header.spacing[r]);
+            info.origin.push_back(header.origin[r]);
+            info.direction.emplace_back(info.dimension);
+        }
+        for (unsigned int r = 0; r < info.dimension; ++r) {
+            for (unsigned int c = 0; c < info.dimension; ++c) {
+                info.direction[c][r] = header.direction[r * info.dimension + c];
+            }
+        }
+        detail::visitPixelTag(header.pixelTag, [&]<typename T>() {
+            info.component = itk::ImageIOBase::MapPixelType<T>::CType;
+            info.componentType = itk::ImageIOBase::GetComponentTypeAsString(info.component);
+            info.componentBytes = sizeof(T);
+        });
+        info.pixelType = "scalar";
+        info.fileBytes = std::filesystem::file_size(filename);
+        return info;
+    }
+
+    auto io = itk::ImageIOFactory::CreateImageIO(filename.string().c_str(),
+                                                 itk::IOFileModeEnum::ReadMode);
+    if (!io) {
+        throw std::runtime_error(std::format("No ImageIO can read '{}'", filename.string()));
+    }
+    io->SetFileName(filename.string());
+    try {
+        io->ReadImageInformation();
+    } catch (const itk::ExceptionObject& err) {
+        throw std::runtime_error(std::format(
+            "Error reading header of '{}': {}", filename.string(), err.GetDescription()));
+    }
+
+    ImageInformation info;
+    info.path = filename;
+    info.dimension = io->GetNumberOfDimensions();
+    for (unsigned int d = 0; d < info.dimension; ++d) {
+        info.size.push_back(io->GetDimensions(d));
+        info.spacing.push_back(io->GetSpacing(d));
+        info.origin.push_back(io->GetOrigin(d));
+        info.direction.push_back(io->GetDirection(d));
+    }
+    info.component = io->GetComponentType();
+    info.componentType = itk::ImageIOBase::GetComponentTypeAsString(info.component);
+    info.pixelType = itk::ImageIOBase::GetPixelTypeAsString(io->GetPixelType());
+    info.components = io->GetNumberOfComponents();
+    info.componentBytes = io->GetComponentSize();
+    std::error_code ec;
+    info.fileBytes = std::filesystem::file_size(filename, ec);
+    return info;
+}
+
+// One line per file: name, size, spacing, pixel type, on-disk and decoded size.
+inline void printImageInformation(const ImageInformation& info, std::ostream& out = std::cout) {
+    std::string size, spacing;
+    for (unsigned int d = 0; d < info.dimension; ++d) {
+        size += std::format("{}{}", d ? " x " : "", info.size[d]);
+        spacing += std::format("{}{:.3f}", d ? ", " : "", info.spacing[d]);
+    }
+    out << std::format("{}  {}  spacing {}  {} {}{}  {:.1f} MB on disk, {:.1f} MB decoded\n",
+                       info.path.filename().string(), size, spacing, info.componentType,
+                       info.pixelType,
+                       info.components > 1 ? std::format("[{}]", info.components) : "",
+                       info.fileBytes / 1e6, info.pixelBytes() / 1e6);
+}
+
 template <typename TPixel, unsigned int VDimension>
 class ImageIO {
 public:
     using ImageType = itk::Image<TPixel, VDimension>;
     using ImagePointer = typename ImageType::Pointer;
+    using ConstImagePointer = typename ImageType::ConstPointer;
+    using RegionType = typename ImageType::RegionType;
     using ReaderType = itk::ImageFileReader<ImageType>;
     using WriterType = itk::ImageFileWriter<ImageType>;
 
+    // With ITKEXP_CACHE_DIR set, scalar images are read through the memory-mapped cache
+    // (io/MappedCache.hpp): decoded once, then mapped without copying on later reads.
     [[nodiscard]] static ImagePointer readImage(const std::filesystem::path& filename) {
+        if constexpr (std::is_arithmetic_v<TPixel>) {
+            if (isBricked(filename)) {
+                return readBricked<ImageType>(filename);
+            }
+            if (const auto& cacheDir = mappedCacheDirectory(); !cacheDir.empty()) {
+                return readMappedImage<ImageType>(filename, cacheDir);
+            }
+        }
+        try {
+            // Block-gzip .nii.gz files (see writeImage) are inflated on several threads
+            return readImageFile<ImageType>(filename);
+        } catch (const itk::ExceptionObject& err) {
+            throw std::runtime_error(std::format(
+                "Error reading '{}': {}", filename.string(), err.GetDescription()));
+        }
+    }
+
+    // Reads through the process-wide LRU cache (io/ImageCache.hpp): an unchanged file read again
+    // as the same type is not decoded twice. The image is shared with every other caller.
+    [[nodiscard]] static ConstImagePointer readShared(const std::filesystem::path& filename) {
+        return ImageCache::instance().get<ImageType>(filename,
+                                                     [&] { return readImage(filename); });
+    }
+
+    // Reads only `region` of the file. The reader streams: formats that support it
+    // (uncompressed NRRD and MetaImage, NIfTI) load little more than the region, others are
+    // read whole by ITK. The result is cropped to exactly `region`, keeping its index and the
+    // file's geometry. If streamed is given, it tells whether less than the volume was loaded.
+    [[nodiscard]] static ImagePointer readRegion(const std::filesystem::path& filename,
+                                                 const RegionType& region,
+                                                 bool* streamed = nullptr) {
+        if constexpr (std::is_arithmetic_v<TPixel>) {
+            if (isBricked(filename)) {
+                // Only the intersecting bricks are read and inflated
+                auto image = readBricked<ImageType>(filename, &region);
+                if (streamed) {
+                    *streamed = true;
+                }
+                return image;
+            }
+        }
         auto reader = ReaderType::New();
         reader->SetFileName(filename.string());
+        reader->UseStreamingOn();
+        ImagePointer image;
         try {
+            reader->UpdateOutputInformation();
+            const auto largest = reader->GetOutput()->GetLargestPossibleRegion();
+            if (!largest.IsInside(region)) {
+                throw std::out_of_range(std::format("Region outside of '{}'", filename.string()));
+            }
+            reader->GetOutput()->SetRequestedRegion(region);
             reader->Update();
+            image = reader->GetOutput();
+            image->DisconnectPipeline();
+            if (streamed) {
+                *streamed = image->GetBufferedRegion() != largest;
+            }
         } catch (const itk::ExceptionObject& err) {
             throw std::runtime_error(std::format(
                 "Error reading '{}': {}", filename.string(), err.GetDescription()));
         }
-        // Return smart pointer — caller shares ownership with ITK pipeline
-        return reader->GetOutput();
+        if (image->GetBufferedRegion() == region) {
+            image->SetLargestPossibleRegion(region);
+            return image;
+        }
+
+        // The reader delivered more than asked (whole slices, or the whole volume)
+        auto cropped = ImageType::New();
+        cropped->CopyInformation(image);
+        cropped->SetRegions(region);
+        cropped->Allocate();
+        itk::ImageAlgorithm::Copy(image.GetPointer(), cropped.GetPointer(), region, region);
+        return cropped;
     }
 
-    static void writeImage(const ImagePointer& image, const std::filesystem::path& filename) {
+    // A .nii.gz is compressed in parallel blocks (io/ParallelGzip.hpp) and a .ixb is written
+    // as a bricked volume (io/BrickedVolume.hpp), both at compressionLevel 0-9, by default
+    // ITKEXP_GZIP_LEVEL or 6. Any gzip reader can still decode the .nii.gz.
+    static void writeImage(const ImagePointer& image, const std::filesystem::path& filename,
+                           int compressionLevel = -1) {
         if (!image) {
             throw std::invalid_argument("Null image pointer passed to writeImage().");
         }
 
-        auto writer = WriterType::New();
-        writer->SetFileName(filename.string());
-        writer->SetInput(image);
-
         try {
-            writer->Update();
+            if constexpr (std::is_arithmetic_v<TPixel>) {
+                if (isBricked(filename)) {
+                    writeBricked<ImageType>(image.GetPointer(), filename, compressionLevel);
+                    return;
+                }
+            }
+            writeImageFile<ImageType>(image.GetPointer(), filename, compressionLevel);
         } catch (const itk::ExceptionObject& err) {
             throw std::runtime_error(std::format(
                 "Error writing '{}': {}", filename.string(), err.GetDescription()));
         }
     }
 
+    // Header only: geometry and pixel type of a file without reading its voxels.
+    [[nodiscard]] static ImageInformation readInformation(const std::filesystem::path& filename) {
+        return readImageInformation(filename);
+    }
+
     static void printImageInfo(const ImagePointer& image) {
         if (!image) {
             std::cerr << "⚠️ No image loaded.\n";
@@ -69,4 +279,61 @@ public:
     }
 };
 
+namespace detail {
+
+template <typename... Ts, typename Fn>
+bool visitComponentOf(itk::IOComponentEnum component, Fn& fn) {
+    return ((component == itk::ImageIOBase::MapPixelType<Ts>::CType
+                 ? (fn.template operator()<Ts>(), true)
+                 : false) ||
+            ...);
+}
+
+} // namespace detail
+
+// Calls fn.template operator()<T>() with T the component type stored in the file: uint8,
+// int8, uint16, int16, uint32, int32, float or double. Other types (64-bit integers) and
+// multi-component pixels are visited as float, which ITK converts to on read.
+template <typename Fn>
+void visitComponentType(const ImageInformation& info, Fn&& fn) {
+    if (info.components != 1 ||
+        !detail::visitComponentOf<std::uint8_t, std::int8_t, std::uint16_t, std::int16_t,
+                                  std::uint32_t, std::int32_t, float, double>(info.component,
+                                                                              fn)) {
+        fn.template operator()<float>();
+    }
+}
+
+/**
+ * @brief Read an image in its on-disk pixel type
+ *
+ * Reads the header, then `filename` as itk::Image<T, VDimension> with T chosen by
+ * visitComponentType, and calls visitor(image) with the image pointer. The visitor is a
+ * generic lambda. Converting to float is left to the algorithms that need it, so 16-bit
+ * scanner data takes half the memory and bandwidth of a float read.
+ */
+template <unsigned int VDimension, typename TVisitor>
+void readNativeImage(const std::filesystem::path& filename, TVisitor&& visitor) {
+    visitComponentType(readImageInformation(filename), [&]<typename TPixel>() {
+        visitor(ImageIO<TPixel, VDimension>::readImage(filename));
+    });
+}
+
+// Pixel memory of an image against the same image read as float, e.g.
+// "📦 t1.nii.gz: unsigned_short pixels, 16.8 MB (33.6 MB as float)".
+template <typename TImage>
+void printPixelMemory(const TImage* image, const std::string& name,
+                      std::ostream& out = std::cout) {
+    using PixelType = typename TImage::PixelType;
+    const double pixels = image->GetBufferedRegion().GetNumberOfPixels();
+    out << std::format("📦 {}: {} pixels, {:.1f} MB", name,
+                       itk::ImageIOBase::GetComponentTypeAsString(
+                           itk::ImageIOBase::MapPixelType<PixelType>::CType),
+                       pixels * sizeof(PixelType) / 1e6);
+    if constexpr (!std::is_same_v<PixelType, float>) {
+        out << std::format(" ({:.1f} MB as float)", pixels * sizeof(float) / 1e6);
+    }
+    out << "\n";
+}
+
 } // namespace itkexp
@@ -0,0 +1,254 @@
+#pragma once
+#include <itkImage.h>
+#include <itkImportImageContainer.h>
+
+#include "io/ParallelGzip.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace itkexp {
+
+// Pixel buffer backed by a file mapping. The mapping is MAP_PRIVATE, so writes to the image
+// are copy-on-write and never reach the file. It is unmapped with the container.
+template <typename TElementIdentifier, typename TElement>
+class MappedImageContainer : public itk::ImportImageContainer<TElementIdentifier, TElement> {
+public:
+    ITK_DISALLOW_COPY_AND_MOVE(MappedImageContainer);
+
+    using Self = MappedImageContainer;
+    using Superclass = itk::ImportImageContainer<TElementIdentifier, TElement>;
+    using Pointer = itk::SmartPointer<Self>;
+    using ConstPointer = itk::SmartPointer<const Self>;
+
+    itkNewMacro(Self);
+    itkTypeMacro(MappedImageContainer, ImportImageContainer);
+
+    // Takes over `length` mapped bytes at `base`; the elements start at `data`.
+    void SetMapping(void* base, std::size_t length, TElement* data, TElementIdentifier elements) {
+        unmap();
+        m_base = base;
+        m_length = length;
+        this->SetImportPointer(data, elements, false);
+    }
+
+protected:
+    MappedImageContainer() = default;
+    ~MappedImageContainer() override { unmap(); }
+
+private:
+    void unmap() {
+        if (m_base) {
+            munmap(m_base, m_length);
+        }
+        m_base = nullptr;
+        m_length = 0;
+    }
+
+    void* m_base = nullptr;
+    std::size_t m_length = 0;
+};
+
+// Layout of a cache entry: this header, then the pixels at MappedCacheDataOffset (page
+// aligned), raw and in the reader's pixel type. The source path, mtime and size identify the
+// input the entry was converted from.
+inline constexpr std::size_t MappedCacheDataOffset = 4096;
+inline constexpr unsigned int MappedCacheMaxDimension = 4;
+
+struct MappedCacheHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t dimension;
+    char pixelTag[8];
+    std::int64_t sourceMtimeNs;
+    std::uint64_t sourceBytes;
+    std::uint64_t size[MappedCacheMaxDimension];
+    double spacing[MappedCacheMaxDimension];
+    double origin[MappedCacheMaxDimension];
+    double direction[MappedCacheMaxDimension * MappedCacheMaxDimension];
+    char sourcePath[3072];
+};
+static_assert(sizeof(MappedCacheHeader) <= MappedCacheDataOffset);
+static_assert(std::is_trivially_copyable_v<MappedCacheHeader>);
+
+// Cache directory from ITKEXP_CACHE_DIR; empty (cache disabled) when unset.
+inline const std::filesystem::path& mappedCacheDirectory() {
+    static const std::filesystem::path dir = [] {
+        const char* env = std::getenv("ITKEXP_CACHE_DIR");
+        return std::filesystem::path(env ? env : "");
+    }();
+    return dir;
+}
+
+// "f32", "u16", ...: the pixel type part of a cache key.
+template <typename TPixel>
+std::string mappedPixelTag() {
+    const char kind = std::is_floating_point_v<TPixel> ? 'f' : std::is_signed_v<TPixel> ? 'i' : 'u';
+    return std::format("{}{}", kind, sizeof(TPixel) * 8);
+}
+
+/**
+ * @brief Read an image through the uncompressed memory-mapped cache
+ *
+ * The first read of a file decodes it once and stores the pixels raw in `cacheDir`, keyed by
+ * absolute path, pixel type and dimension. Later reads map the entry and hand its pages to the
+ * image without copying or decompressing. An entry whose source path, mtime or size no longer
+ * matches is rebuilt. Entries are written to a temporary file and renamed, so concurrent tools
+ * and threads may share the directory. If the entry cannot be written the decoded image is
+ * returned.
+ */
+template <typename TImage>
+typename TImage::Pointer readMappedImage(const std::filesystem::path& filename,
+                                         const std::filesystem::path& cacheDir) {
+    using PixelType = typename TImage::PixelType;
+    constexpr unsigned int Dimension = TImage::ImageDimension;
+    static_assert(std::is_arithmetic_v<PixelType>, "the mapped cache holds scalar pixels");
+    static_assert(Dimension <= MappedCacheMaxDimension);
+
+    auto decode = [&] {
+        try {
+            return readImageFile<TImage>(filename);
+        } catch (const itk::ExceptionObject& err) {
+            throw std::runtime_error(std::format(
+                "Error reading '{}': {}", filename.string(), err.GetDescription()));
+        }
+    };
+
+    const auto source = std::filesystem::absolute(filename).lexically_normal().string();
+    struct stat st {};
+    if (source.size() >= sizeof(MappedCacheHeader::sourcePath) ||
+        stat(source.c_str(), &st) != 0) {
+        return decode();
+    }
+    const std::int64_t mtimeNs =
+        std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    const std::string tag = mappedPixelTag<PixelType>();
+    const auto entry = cacheDir / std::format("{:016x}-{}d-{}.raw",
+                                              std::hash<std::string>{}(source), Dimension, tag);
+
+    // Hit: map the entry and wrap it if it was converted from this very file
+    auto tryMap = [&]() -> typename TImage::Pointer {
+        const int fd = open(entry.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat es {};
+        void* base = MAP_FAILED;
+        if (fstat(fd, &es) == 0 && std::size_t(es.st_size) >= MappedCacheDataOffset) {
+            base = mmap(nullptr, es.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (base == MAP_FAILED) {
+            return nullptr;
+        }
+
+        MappedCacheHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        std::size_t voxels = 1;
+        for (unsigned int d = 0; d < Dimension; ++d) {
+            voxels *= header.size[d];
+        }
+        if (std::memcmp(header.magic, "ITKXRAW", 8) != 0 || header.version != 1 ||
+            header.dimension != Dimension || tag != header.pixelTag ||
+            header.sourceMtimeNs != mtimeNs || header.sourceBytes != std::uint64_t(st.st_size) ||
+            source != header.sourcePath ||
+            std::size_t(es.st_size) != MappedCacheDataOffset + voxels * sizeof(PixelType)) {
+            munmap(base, es.st_size);
+            return nullptr;
+        }
+
+        typename TImage::SizeType size;
+        typename TImage::SpacingType spacing;
+        typename TImage::PointType origin;
+        typename TImage::DirectionType direction;
+        for (unsigned int r = 0; r < Dimension; ++r) {
+            size[r] = header.size[r];
+            spacing[r] = header.spacing[r];
+            origin[r] = header.origin[r];
+            for (unsigned int c = 0; c < Dimension; ++c) {
+                direction[r][c] = header.direction[r * Dimension + c];
+            }
+        }
+        auto container = MappedImageContainer<itk::SizeValueType, PixelType>::New();
+        container->SetMapping(
+            base, es.st_size,
+            reinterpret_cast<PixelType*>(static_cast<char*>(base) + MappedCacheDataOffset),
+            voxels);
+
+        auto image = TImage::New();
+        image->SetRegions(size);
+        image->SetSpacing(spacing);
+        image->SetOrigin(origin);
+        image->SetDirection(direction);
+        image->SetPixelContainer(container);
+        return image;
+    };
+
+    if (auto image = tryMap()) {
+        return image;
+    }
+
+    // Miss or stale: decode once, store raw, then map the new entry
+    auto image = decode();
+    MappedCacheHeader header{};
+    std::memcpy(header.magic, "ITKXRAW", 8);
+    header.version = 1;
+    header.dimension = Dimension;
+    std::snprintf(header.pixelTag, sizeof(header.pixelTag), "%s", tag.c_str());
+    header.sourceMtimeNs = mtimeNs;
+    header.sourceBytes = st.st_size;
+    const auto size = image->GetLargestPossibleRegion().GetSize();
+    for (unsigned int r = 0; r < Dimension; ++r) {
+        header.size[r] = size[r];
+        header.spacing[r] = image->GetSpacing()[r];
+        header.origin[r] = image->GetOrigin()[r];
+        for (unsigned int c = 0; c < Dimension; ++c) {
+            header.direction[r * Dimension + c] = image->GetDirection()[r][c];
+        }
+    }
+    std::snprintf(header.sourcePath, sizeof(header.sourcePath), "%s", source.c_str());
+
+    std::error_code ec;
+    std::filesystem::create_directories(cacheDir, ec);
+    const auto temp = detail::siblingTempName(entry);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        std::string page(MappedCacheDataOffset, '\0');
+        std::memcpy(page.data(), &header, sizeof(header));
+        out.write(page.data(), page.size());
+        out.write(reinterpret_cast<const char*>(image->GetBufferPointer()),
+                  std::streamsize(image->GetPixelContainer()->Size() * sizeof(PixelType)));
+        if (!out) {
+            std::cerr << std::format("⚠️ Cannot write cache entry for '{}' in {}\n",
+                                     filename.string(), cacheDir.string());
+            std::filesystem::remove(temp, ec);
+            return image;
+        }
+    }
+    std::filesystem::rename(temp, entry, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return image;
+    }
+    if (auto mapped = tryMap()) {
+        return mapped;
+    }
+    return image;
+}
+
+} // namespace itkexp
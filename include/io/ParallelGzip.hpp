@@ -0,0 +1,326 @@
+#pragma once
+#include <itkImageFileReader.h>
+#include <itkImageFileWriter.h>
+#include <itk_zlib.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace itkexp {
+
+// Block gzip: the data is cut into fixed-size blocks and each block is compressed on its own
+// into a complete gzip member. Concatenated members are a valid gzip file for every reader
+// (gzip, zlib's gzread and so ITK's NIfTI reader). Each member carries an "IX" extra field
+// with its compressed size, so our reader can locate all blocks up front and inflate them in
+// parallel.
+
+// Threads for block gzip from ITKEXP_GZIP_THREADS (1 disables the parallel path); default
+// all cores.
+inline unsigned int gzipThreads() {
+    if (const char* env = std::getenv("ITKEXP_GZIP_THREADS")) {
+        return std::max(1, std::atoi(env));
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Compression level from ITKEXP_GZIP_LEVEL (0 stored .. 9 smallest); default 6, zlib's own.
+inline int gzipLevel() {
+    if (const char* env = std::getenv("ITKEXP_GZIP_LEVEL")) {
+        return std::clamp(std::atoi(env), 0, 9);
+    }
+    return 6;
+}
+
+inline bool isNiftiGz(const std::filesystem::path& path) {
+    return path.string().ends_with(".nii.gz");
+}
+
+namespace detail {
+
+// 10 fixed bytes, XLEN, then the "IX" subfield: SI1 SI2, SLEN = 4, member size.
+inline constexpr std::size_t GzipHeaderBytes = 20;
+inline constexpr std::size_t GzipTrailerBytes = 8; // CRC32, ISIZE
+
+inline void put32(unsigned char* p, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = static_cast<unsigned char>(v >> (8 * i));
+    }
+}
+
+inline std::uint32_t get32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+// Runs fn(i) for i in [0, n) on up to `threads` threads; the first exception is rethrown.
+template <typename Fn>
+void parallelFor(std::size_t n, unsigned int threads, Fn&& fn) {
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto work = [&] {
+        for (std::size_t i; (i = next++) < n;) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = n;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < std::min<std::size_t>(threads, n); ++t) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Process-wide sequence number that makes temporary names unique between threads.
+inline unsigned int nextTempId() {
+    static std::atomic<unsigned int> counter{0};
+    return counter++;
+}
+
+// Name next to `path` to write it under before the rename, unique across processes and across
+// threads of one process, which may write the same path at once.
+inline std::string siblingTempName(const std::filesystem::path& path) {
+    return path.string() + std::format(".{}-{}.tmp", getpid(), nextTempId());
+}
+
+// Unique file in the temporary directory, removed with the object.
+struct TempFile {
+    explicit TempFile(const std::string& suffix) {
+        path = std::filesystem::temp_directory_path() /
+               std::format("itkexp-{}-{}{}", getpid(), nextTempId(), suffix);
+    }
+    ~TempFile() {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+
+    std::filesystem::path path;
+};
+
+inline std::string readFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error(std::format("Cannot open '{}'", path.string()));
+    }
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+} // namespace detail
+
+// Compresses `bytes` bytes into block gzip members of blockBytes input each, in parallel, and
+// writes them to `path` (through a temporary file and rename).
+inline void writeBlockGzip(const std::filesystem::path& path, const char* data, std::size_t bytes,
+                           int level, unsigned int threads, std::size_t blockBytes = 1 << 20) {
+    using namespace detail;
+    const std::size_t blocks = std::max<std::size_t>(1, (bytes + blockBytes - 1) / blockBytes);
+    std::vector<std::string> members(blocks);
+    parallelFor(blocks, threads, [&](std::size_t b) {
+        const auto* in = reinterpret_cast<const Bytef*>(data) + b * blockBytes;
+        const auto length = static_cast<uInt>(std::min(blockBytes, bytes - b * blockBytes));
+
+        z_stream zs{};
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+        auto& member = members[b];
+        member.resize(GzipHeaderBytes + deflateBound(&zs, length) + GzipTrailerBytes);
+        auto* out = reinterpret_cast<unsigned char*>(member.data());
+        zs.next_in = const_cast<Bytef*>(in);
+        zs.avail_in = length;
+        zs.next_out = out + GzipHeaderBytes;
+        zs.avail_out = static_cast<uInt>(member.size() - GzipHeaderBytes - GzipTrailerBytes);
+        const int rc = deflate(&zs, Z_FINISH);
+        const std::size_t payload = zs.total_out;
+        deflateEnd(&zs);
+        if (rc != Z_STREAM_END) {
+            throw std::runtime_error("deflate failed");
+        }
+
+        member.resize(GzipHeaderBytes + payload + GzipTrailerBytes);
+        out = reinterpret_cast<unsigned char*>(member.data());
+        const unsigned char header[14] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0, 'I', 'X'};
+        std::copy(std::begin(header), std::end(header), out);
+        out[14] = 4;
+        out[15] = 0;
+        put32(out + 16, static_cast<std::uint32_t>(member.size()));
+        put32(out + GzipHeaderBytes + payload, crc32(0L, in, length));
+        put32(out + GzipHeaderBytes + payload + 4, length);
+    });
+
+    const auto temp = siblingTempName(path);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        for (const auto& member : members) {
+            out.write(member.data(), static_cast<std::streamsize>(member.size()));
+        }
+        if (!out) {
+            throw std::runtime_error(std::format("Cannot write '{}'", path.string()));
+        }
+    }
+    std::filesystem::rename(temp, path);
+}
+
+// Inflates a block gzip file into `out` on `threads` threads. Returns false (and leaves `out`
+// empty) if the file was not written by writeBlockGzip; throws if a block is corrupt.
+inline bool readBlockGzip(const std::filesystem::path& path, std::string& out,
+                          unsigned int threads) {
+    using namespace detail;
+    out.clear();
+    {
+        // Plain gzip files are left to zlib without reading them twice
+        unsigned char h[GzipHeaderBytes] = {};
+        std::ifstream in(path, std::ios::binary);
+        in.read(reinterpret_cast<char*>(h), sizeof(h));
+        if (!in || h[3] != 4 || h[12] != 'I' || h[13] != 'X') {
+            return false;
+        }
+    }
+    const std::string file = readFile(path);
+    const auto* bytes = reinterpret_cast<const unsigned char*>(file.data());
+
+    struct Member {
+        std::size_t offset, size, outOffset, outSize;
+    };
+    std::vector<Member> members;
+    std::size_t total = 0;
+    for (std::size_t pos = 0; pos < file.size();) {
+        const unsigned char* h = bytes + pos;
+        const bool ours = file.size() - pos >= GzipHeaderBytes + GzipTrailerBytes &&
+                          h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && h[3] == 4 &&
+                          h[10] == 8 && h[11] == 0 && h[12] == 'I' && h[13] == 'X' &&
+                          h[14] == 4 && h[15] == 0;
+        const std::size_t size = ours ? get32(h + 16) : 0;
+        if (!ours || size < GzipHeaderBytes + GzipTrailerBytes || size > file.size() - pos) {
+            if (members.empty()) {
+                return false;
+            }
+            throw std::runtime_error(std::format("Corrupt block gzip '{}'", path.string()));
+        }
+        const std::size_t outSize = get32(h + size - 4);
+        members.push_back({pos, size, total, outSize});
+        total += outSize;
+        pos += size;
+    }
+    if (members.empty()) {
+        return false;
+    }
+
+    out.resize(total);
+    parallelFor(members.size(), threads, [&](std::size_t m) {
+        const auto& member = members[m];
+        auto* dst = reinterpret_cast<Bytef*>(out.data()) + member.outOffset;
+        z_stream zs{};
+        if (inflateInit2(&zs, -15) != Z_OK) {
+            throw std::runtime_error("inflateInit2 failed");
+        }
+        zs.next_in = const_cast<Bytef*>(bytes + member.offset + GzipHeaderBytes);
+        zs.avail_in = static_cast<uInt>(member.size - GzipHeaderBytes - GzipTrailerBytes);
+        zs.next_out = dst;
+        zs.avail_out = static_cast<uInt>(member.outSize);
+        const int rc = inflate(&zs, Z_FINISH);
+        const std::size_t produced = zs.total_out;
+        inflateEnd(&zs);
+        const auto crc = get32(bytes + member.offset + member.size - GzipTrailerBytes);
+        if (rc != Z_STREAM_END || produced != member.outSize ||
+            crc32(0L, dst, static_cast<uInt>(produced)) != crc) {
+            throw std::runtime_error(std::format("Corrupt block {} in '{}'", m, path.string()));
+        }
+    });
+    return true;
+}
+
+// Reads an image file. A .nii.gz written in block gzip is inflated on `threads` threads
+// (default gzipThreads()) into an uncompressed temporary .nii, which ITK then reads;
+// everything else goes straight to ITK. ITK exceptions propagate.
+template <typename TImage>
+typename TImage::Pointer readImageFile(const std::filesystem::path& filename,
+                                       unsigned int threads = 0) {
+    auto reader = itk::ImageFileReader<TImage>::New();
+    reader->SetFileName(filename.string());
+
+    std::string raw;
+    if (!threads) {
+        threads = gzipThreads();
+    }
+    if (isNiftiGz(filename) && threads > 1 && readBlockGzip(filename, raw, threads)) {
+        detail::TempFile temp(".nii");
+        {
+            std::ofstream out(temp.path, std::ios::binary);
+            out.write(raw.data(), static_cast<std::streamsize>(raw.size()));
+            if (!out) {
+                throw std::runtime_error(std::format("Cannot write '{}'", temp.path.string()));
+            }
+        }
+        raw = std::string();
+        reader->SetFileName(temp.path.string());
+        reader->Update();
+        typename TImage::Pointer image = reader->GetOutput();
+        image->DisconnectPipeline();
+        return image;
+    }
+    reader->Update();
+    // Detached as above: threads sharing the image (ImageCache) must never rerun the reader
+    typename TImage::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+    return image;
+}
+
+// Writes an image file. A .nii.gz is written by ITK uncompressed to a temporary .nii and then
+// compressed in block gzip on `threads` threads (default gzipThreads()) at `level` (default
+// gzipLevel()). Other formats, and ITKEXP_GZIP_THREADS=1, use ITK's writer directly; it
+// compresses a .nii.gz, or any format when `level` is given, at that level.
+template <typename TImage>
+void writeImageFile(const TImage* image, const std::filesystem::path& filename, int level = -1,
+                    unsigned int threads = 0) {
+    auto writer = itk::ImageFileWriter<TImage>::New();
+    writer->SetInput(image);
+    if (!threads) {
+        threads = gzipThreads();
+    }
+    if (!isNiftiGz(filename) || threads <= 1) {
+        // ITK's own zlib, at the same level as the block gzip path so the two compare
+        if (isNiftiGz(filename) || level >= 0) {
+            writer->UseCompressionOn();
+            writer->SetCompressionLevel(level < 0 ? gzipLevel() : level);
+        }
+        writer->SetFileName(filename.string());
+        writer->Update();
+        return;
+    }
+
+    detail::TempFile temp(".nii");
+    writer->SetFileName(temp.path.string());
+    writer->Update();
+    const std::string raw = detail::readFile(temp.path);
+    writeBlockGzip(filename, raw.data(), raw.size(), level < 0 ? gzipLevel() : level, threads);
+}
+
+} // namespace itkexp
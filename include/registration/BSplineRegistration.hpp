@@ -3,31 +3,160 @@
 #include "itkImageRegistrationMethodv4.h"
 #include "itkBSplineTransform.h"
 #include "itkBSplineTransformInitializer.h"
+#include "itkBSplineTransformParametersAdaptor.h"
+#include "itkCompositeTransform.h"
+#include "itkContinuousIndex.h"
+#include "itkGradientDescentOptimizerv4.h"
+#include "itkLBFGSBOptimizerv4.h"
 #include "itkMattesMutualInformationImageToImageMetricv4.h"
+#include "itkRegistrationParameterScalesFromPhysicalShift.h"
 #include "itkRegularStepGradientDescentOptimizerv4.h"
 #include "itkResampleImageFilter.h"
 #include "itkImageFileWriter.h"
+#include "registration/MultiResolution.hpp"
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
 
 namespace itkexp
 {
 
+enum class BSplineOptimizer
+{
+    RegularStep, // RegularStepGradientDescentOptimizerv4
+    LBFGSB,      // bounded limited-memory quasi-Newton (LBFGSBOptimizerv4)
+    Stochastic   // gradient descent on a fresh random sample every iteration, decaying step
+};
+
+struct BSplineParameters
+{
+    unsigned int     numberOfLevels    = 1;    // pyramid levels; mesh doubles per finer level
+    unsigned int     iterations        = 200;  // optimizer iterations per level
+    bool             anisotropicShrink = true; // per-axis pyramid shrink factors from spacing
+    BSplineOptimizer optimizer         = BSplineOptimizer::RegularStep;
+    double           lbfgsbBound       = 0.0;  // |coefficient| bound in mm, 0 = unbounded
+    unsigned int     lbfgsbMemory      = 5;    // number of stored corrections
+    unsigned int     stochasticSamples = 3000; // fixed-image points drawn per iteration
+    double           stochasticOffset  = 20.0; // A in step_k = step_0 * ((A+1) / (A+k+1))^alpha
+    double           stochasticAlpha   = 0.602; // alpha of the step decay
+};
+
+inline BSplineOptimizer parseBSplineOptimizer(const std::string& name)
+{
+    if (name == "rsgd")
+        return BSplineOptimizer::RegularStep;
+    if (name == "lbfgsb")
+        return BSplineOptimizer::LBFGSB;
+    if (name == "sgd")
+        return BSplineOptimizer::Stochastic;
+    throw std::invalid_argument("Unknown B-spline optimizer '" + name +
+                                "' (use rsgd, lbfgsb or sgd)");
+}
+
+// Draw count points uniformly over the fixed image domain, as a metric sampled point set.
+template <typename TMetric>
+typename TMetric::FixedSampledPointSetType::Pointer
+randomFixedPoints(const typename TMetric::FixedImageType* image, unsigned int count,
+                  std::mt19937& rng)
+{
+    using PointSetType = typename TMetric::FixedSampledPointSetType;
+    constexpr unsigned int Dim = TMetric::FixedImageType::ImageDimension;
+
+    const auto region = image->GetLargestPossibleRegion();
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    auto points = PointSetType::New();
+    points->Initialize();
+    itk::ContinuousIndex<double, Dim> index;
+    typename PointSetType::PointType point;
+    for (unsigned int i = 0; i < count; ++i) {
+        for (unsigned int d = 0; d < Dim; ++d)
+            index[d] = region.GetIndex()[d] + unit(rng) * (region.GetSize()[d] - 1);
+        image->TransformContinuousIndexToPhysicalPoint(index, point);
+        points->SetPoint(i, point);
+    }
+    return points;
+}
+
+/**
+ * @brief Mattes MI whose sampled points can be replaced between iterations
+ *
+ * Initialize() scans both images for the histogram range, which is O(volume). The stochastic
+ * mode only needs new sample points: ResampleFixedPoints() maps them to the virtual domain
+ * and keeps everything else Initialize() set up for the level.
+ */
+template <typename TFixedImage, typename TMovingImage>
+class ResampledMattesMetric
+    : public itk::MattesMutualInformationImageToImageMetricv4<TFixedImage, TMovingImage>
+{
+public:
+    using Self = ResampledMattesMetric;
+    using Superclass = itk::MattesMutualInformationImageToImageMetricv4<TFixedImage, TMovingImage>;
+    using Pointer = itk::SmartPointer<Self>;
+    using typename Superclass::FixedSampledPointSetType;
+
+    itkNewMacro(Self);
+    itkTypeMacro(ResampledMattesMetric, MattesMutualInformationImageToImageMetricv4);
+
+    void ResampleFixedPoints(FixedSampledPointSetType* points)
+    {
+        this->SetFixedSampledPointSet(points);
+        this->SetUseSampledPointSet(true);
+        this->MapFixedSampledPointSetToVirtual();
+    }
+
+protected:
+    ResampledMattesMetric() = default;
+};
+
+// Number of B-spline coefficients for a mesh, i.e. the optimizer parameter count.
+template <unsigned int Dim, unsigned int SplineOrder>
+unsigned int bsplineParameterCount(const std::array<unsigned int, Dim>& mesh)
+{
+    unsigned int nodes = 1;
+    for (unsigned int i = 0; i < Dim; ++i)
+        nodes *= mesh[i] + SplineOrder;
+    return nodes * Dim;
+}
+
+// meshSize is the control grid of the coarsest level. With N levels the grid is refined
+// meshSize << level (e.g. 4 -> 8 -> 16 for 3 levels) between levels, while the images go
+// through the usual shrink / smoothing pyramid. One level reproduces the full-resolution
+// single-grid registration.
+//
+// An optional initialTransform (typically the affine result) is kept fixed as the moving
+// initial transform. The returned composite applies the B-spline first, then initialTransform,
+// so resampling through it maps fixed -> moving in a single interpolation pass. stats, if
+// given, receives the iteration count and the final metric.
 template <typename TImage, unsigned int SplineOrder = 3>
-typename TImage::Pointer
-bsplineRegister(const typename TImage::Pointer& fixed,
-                const typename TImage::Pointer& moving,
-                const std::array<unsigned int, TImage::ImageDimension>& meshSize, // control grid cells per dim
-                const std::string& outputPath)
+typename itk::CompositeTransform<double, TImage::ImageDimension>::Pointer
+bsplineRegisterTransform(const typename TImage::Pointer& fixed,
+                         const typename TImage::Pointer& moving,
+                         const std::array<unsigned int, TImage::ImageDimension>& meshSize,
+                         const BSplineParameters& params = {},
+                         itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension>*
+                             initialTransform = nullptr,
+                         RegistrationStats* stats = nullptr)
 {
     constexpr unsigned int Dim = TImage::ImageDimension;
     using TransformType = itk::BSplineTransform<double, Dim, SplineOrder>;
     using InitializerType = itk::BSplineTransformInitializer<TransformType, TImage>;
-    using MetricType = itk::MattesMutualInformationImageToImageMetricv4<TImage, TImage>;
+    using AdaptorType = itk::BSplineTransformParametersAdaptor<TransformType>;
+    using MetricType = ResampledMattesMetric<TImage, TImage>;
     using OptimizerType = itk::RegularStepGradientDescentOptimizerv4<double>;
+    using LBFGSBOptimizerType = itk::LBFGSBOptimizerv4;
+    using SGDOptimizerType = itk::GradientDescentOptimizerv4;
+    using ScalesEstimatorType = itk::RegistrationParameterScalesFromPhysicalShift<MetricType>;
     using RegistrationType = itk::ImageRegistrationMethodv4<TImage, TImage, TransformType>;
 
-    // --- Build transform and initialize it over fixed image domain
+    const unsigned int levels = std::max(1u, params.numberOfLevels);
+
+    // --- Build transform and initialize it over fixed image domain with the coarsest mesh
     auto transform = TransformType::New();
     auto initializer = InitializerType::New();
     initializer->SetTransform(transform);
@@ -49,11 +178,40 @@ bsplineRegister(const typename TImage::Pointer& fixed,
     metric->SetUseFixedImageGradientFilter(false);
 
     // --- Optimizer
-    auto optimizer = OptimizerType::New();
-    optimizer->SetLearningRate(1.0);
-    optimizer->SetMinimumStepLength(0.0005);
-    optimizer->SetRelaxationFactor(0.7);
-    optimizer->SetNumberOfIterations(200);
+    typename RegistrationType::OptimizerType::Pointer optimizer;
+    typename LBFGSBOptimizerType::Pointer lbfgsb;
+    typename SGDOptimizerType::Pointer sgd;
+    if (params.optimizer == BSplineOptimizer::Stochastic) {
+        // The first step of each level is sized from the physical shift it produces; later
+        // steps decay from there. Per-parameter scales are not estimated (thousands of
+        // coefficients), only the learning rate.
+        auto scalesEstimator = ScalesEstimatorType::New();
+        scalesEstimator->SetMetric(metric);
+        scalesEstimator->SetTransformForward(true);
+
+        sgd = SGDOptimizerType::New();
+        sgd->SetNumberOfIterations(params.iterations);
+        sgd->SetScalesEstimator(scalesEstimator);
+        sgd->SetDoEstimateScales(false);
+        sgd->SetDoEstimateLearningRateOnce(true);
+        sgd->SetDoEstimateLearningRateAtEachIteration(false);
+        optimizer = sgd;
+    } else if (params.optimizer == BSplineOptimizer::LBFGSB) {
+        lbfgsb = LBFGSBOptimizerType::New();
+        lbfgsb->SetCostFunctionConvergenceFactor(1e7);
+        lbfgsb->SetGradientConvergenceTolerance(1e-35);
+        lbfgsb->SetNumberOfIterations(params.iterations);
+        lbfgsb->SetMaximumNumberOfFunctionEvaluations(2 * params.iterations);
+        lbfgsb->SetMaximumNumberOfCorrections(params.lbfgsbMemory);
+        optimizer = lbfgsb;
+    } else {
+        auto rsgd = OptimizerType::New();
+        rsgd->SetLearningRate(1.0);
+        rsgd->SetMinimumStepLength(0.0005);
+        rsgd->SetRelaxationFactor(0.7);
+        rsgd->SetNumberOfIterations(params.iterations);
+        optimizer = rsgd;
+    }
 
     // --- Registration
     auto registration = RegistrationType::New();
@@ -63,25 +221,163 @@ bsplineRegister(const typename TImage::Pointer& fixed,
     registration->SetOptimizer(optimizer);
     registration->SetInitialTransform(transform);
     registration->InPlaceOn();
+    if (initialTransform)
+        registration->SetMovingInitialTransform(initialTransform);
+
+    // --- Pyramid and mesh refinement. The adaptors keep the transform domain of the fixed
+    // image and only change the number of control points.
+    configurePyramid(registration.GetPointer(), fixed.GetPointer(), levels,
+                     params.anisotropicShrink);
+
+    typename RegistrationType::TransformParametersAdaptorsContainerType adaptors;
+    for (unsigned int level = 0; level < levels; ++level) {
+        typename TransformType::MeshSizeType levelMesh;
+        for (unsigned int i = 0; i < Dim; ++i)
+            levelMesh[i] = meshSize[i] << level;
+
+        auto adaptor = AdaptorType::New();
+        adaptor->SetTransform(transform);
+        adaptor->SetRequiredTransformDomainMeshSize(levelMesh);
+        adaptor->SetRequiredTransformDomainOrigin(transform->GetTransformDomainOrigin());
+        adaptor->SetRequiredTransformDomainDirection(transform->GetTransformDomainDirection());
+        adaptor->SetRequiredTransformDomainPhysicalDimensions(
+            transform->GetTransformDomainPhysicalDimensions());
+        adaptors.push_back(adaptor);
+    }
+    registration->SetTransformParametersAdaptorsPerLevel(adaptors);
+
+    auto levelTimer = LevelTimer::New();
+    levelTimer->SetOptimizer(optimizer);
+    registration->AddObserver(itk::MultiResolutionIterationEvent(), levelTimer);
+
+    // LBFGSB needs one bound entry per parameter, and the parameter count changes with the
+    // mesh, so the bounds are rebuilt from the mesh schedule at the start of every level.
+    if (lbfgsb) {
+        auto level = std::make_shared<unsigned int>(0);
+        auto resizeBounds = [=](const itk::EventObject&) {
+            std::array<unsigned int, Dim> levelMesh;
+            for (unsigned int i = 0; i < Dim; ++i)
+                levelMesh[i] = meshSize[i] << *level;
+            const unsigned int n = bsplineParameterCount<Dim, SplineOrder>(levelMesh);
+            ++*level;
+
+            // vnl_lbfgsb bound codes: 0 = unbounded, 2 = lower and upper bound
+            typename LBFGSBOptimizerType::BoundSelectionType boundSelect(n);
+            typename LBFGSBOptimizerType::BoundValueType lower(n);
+            typename LBFGSBOptimizerType::BoundValueType upper(n);
+            boundSelect.Fill(params.lbfgsbBound > 0.0 ? 2 : 0);
+            lower.Fill(-params.lbfgsbBound);
+            upper.Fill(params.lbfgsbBound);
+            lbfgsb->SetBoundSelection(boundSelect);
+            lbfgsb->SetLowerBound(lower);
+            lbfgsb->SetUpperBound(upper);
+        };
+        registration->AddObserver(itk::MultiResolutionIterationEvent(), resizeBounds);
+    }
+
+    // Stochastic mode: every level starts from a random subset sized to stochasticSamples, and
+    // after every iteration the metric gets a fresh random sample and the step size decays.
+    // The image ranges from the level's Initialize() are kept, so each iteration costs the
+    // same, whatever the image size.
+    if (sgd) {
+        const auto& size = fixed->GetLargestPossibleRegion().GetSize();
+        typename RegistrationType::MetricSamplingPercentageArrayType percentages;
+        percentages.SetSize(levels);
+        for (unsigned int level = 0; level < levels; ++level) {
+            const auto factors = registration->GetShrinkFactorsPerDimension(level);
+            double voxels = 1.0;
+            for (unsigned int i = 0; i < Dim; ++i)
+                voxels *= std::max<unsigned long>(1, size[i] / factors[i]);
+            percentages[level] = std::min(1.0, params.stochasticSamples / voxels);
+        }
+        registration->SetMetricSamplingStrategy(
+            RegistrationType::MetricSamplingStrategyEnum::RANDOM);
+        registration->SetMetricSamplingPercentagePerLevel(percentages);
+
+        auto* sgdOptimizer = sgd.GetPointer();  // raw: the observer is owned by the optimizer
+        auto* sampledMetric = metric.GetPointer();
+        auto rng = std::make_shared<std::mt19937>(12345);
+        auto initialRate = std::make_shared<double>(0.0);
+        auto resample = [=](const itk::EventObject&) {
+            const double k = sgdOptimizer->GetCurrentIteration();
+            if (k == 0)
+                *initialRate = sgdOptimizer->GetLearningRate();
+            const double A = params.stochasticOffset;
+            const double decay = std::pow((A + 1.0) / (A + k + 2.0), params.stochasticAlpha);
+            sgdOptimizer->SetLearningRate(*initialRate * decay);
+
+            sampledMetric->ResampleFixedPoints(randomFixedPoints<MetricType>(
+                sampledMetric->GetFixedImage(), params.stochasticSamples, *rng));
+        };
+        sgd->AddObserver(itk::IterationEvent(), resample);
+    }
+
+    // Every RSGD/SGD iteration evaluates the metric and its gradient once; LBFGSB may evaluate
+    // several times per iteration during its line search, so count those events instead.
+    auto evaluations = std::make_shared<unsigned long>(0);
+    auto countEvaluation = [evaluations](const itk::EventObject&) { ++*evaluations; };
+    if (lbfgsb)
+        optimizer->AddObserver(itk::FunctionAndGradientEvaluationIterationEvent(), countEvaluation);
+    else
+        optimizer->AddObserver(itk::IterationEvent(), countEvaluation);
 
     std::cout << "🚀 B-spline registration: mesh = {";
     for (unsigned i = 0; i < Dim; ++i)
         std::cout << meshSize[i] << (i + 1 < Dim ? "," : "");
-    std::cout << "}, order = " << SplineOrder << "\n";
+    std::cout << "}, order = " << SplineOrder << ", levels = " << levels << ", optimizer = "
+              << (lbfgsb ? "LBFGSB" : sgd ? "StochasticGD" : "RegularStepGD") << "\n";
+    if (sgd)
+        std::cout << "   " << params.stochasticSamples << " random samples per iteration\n";
+    if (levels > 1) {
+        std::cout << "   mesh refined x2 per level, final mesh = {";
+        for (unsigned i = 0; i < Dim; ++i)
+            std::cout << (meshSize[i] << (levels - 1)) << (i + 1 < Dim ? "," : "");
+        std::cout << "}\n";
+        printPyramidSchedule(registration.GetPointer(), fixed.GetPointer());
+    }
 
     try {
         registration->Update();
-        std::cout << "✅ B-spline registration finished.\n";
+        levelTimer->Stop();
+        std::cout << "✅ B-spline registration finished. Final metric: " << optimizer->GetValue()
+                  << ", metric+gradient evaluations: " << *evaluations << "\n";
+        if (stats)
+            *stats = levelTimer->GetStats();
     } catch (const itk::ExceptionObject& e) {
         std::cerr << "B-spline registration failed: " << e << std::endl;
         return nullptr;
     }
 
+    using CompositeType = itk::CompositeTransform<double, Dim>;
+    auto composite = CompositeType::New();
+    if (initialTransform)
+        composite->AddTransform(initialTransform);
+    composite->AddTransform(transform);
+    return composite;
+}
+
+// Register, resample moving into fixed space once through the full transform chain and write
+// the result to outputPath.
+template <typename TImage, unsigned int SplineOrder = 3>
+typename TImage::Pointer
+bsplineRegister(const typename TImage::Pointer& fixed,
+                const typename TImage::Pointer& moving,
+                const std::array<unsigned int, TImage::ImageDimension>& meshSize, // control grid cells per dim
+                const std::string& outputPath,
+                const BSplineParameters& params = {},
+                itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension>*
+                    initialTransform = nullptr)
+{
+    auto composite = bsplineRegisterTransform<TImage, SplineOrder>(fixed, moving, meshSize,
+                                                                   params, initialTransform);
+    if (!composite)
+        return nullptr;
+
     // --- Resample moving into fixed space
     using ResampleType = itk::ResampleImageFilter<TImage, TImage>;
     auto resampler = ResampleType::New();
     resampler->SetInput(moving);
-    resampler->SetTransform(registration->GetTransform());
+    resampler->SetTransform(composite);
     resampler->SetReferenceImage(fixed);
     resampler->UseReferenceImageOn();
     resampler->Update();
@@ -93,6 +389,8 @@ bsplineRegister(const typename TImage::Pointer& fixed,
     writer->Update();
 
     std::cout << "💾 B-spline result written: " << outputPath << std::endl;
-    return resampler->GetOutput();
+    typename TImage::Pointer output = resampler->GetOutput();
+    output->DisconnectPipeline(); // see resampleToFixed
+    return output;
 }
 } // namespace itkexp
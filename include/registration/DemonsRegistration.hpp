@@ -0,0 +1,184 @@
+#pragma once
+#include "itkDiffeomorphicDemonsRegistrationFilter.h"
+#include "itkHistogramMatchingImageFilter.h"
+#include "itkImage.h"
+#include "itkImageAlgorithm.h"
+#include "itkMultiResolutionPDEDeformableRegistration.h"
+#include "itkSmoothingRecursiveGaussianImageFilter.h"
+#include "itkTransform.h"
+#include "registration/DisplacementField.hpp"
+#include "registration/MultiResolution.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace itkexp
+{
+
+struct DemonsParameters
+{
+    unsigned int numberOfLevels = 3;     // pyramid levels, each halves the resolution
+    unsigned int iterations     = 50;    // demons iterations per level
+    double       fieldSigma     = 1.5;   // field smoothing in voxels (elastic regularization)
+    double       updateSigma    = 0.0;   // update smoothing in voxels (fluid), 0 = off
+    double       maxStepLength  = 2.0;   // largest update per iteration, in voxels
+    bool         histogramMatch = true;  // match moving intensities to fixed (mono-modal)
+};
+
+// Diffeomorphic demons with the symmetric (ESM) force whose field and update regularization use
+// separable recursive Gaussians: the cost per voxel does not depend on sigma, unlike the
+// truncated Gaussian kernels of the stock filter.
+template <typename TImage, typename TField>
+class RecursiveGaussianDemonsFilter
+    : public itk::DiffeomorphicDemonsRegistrationFilter<TImage, TImage, TField>
+{
+public:
+    ITK_DISALLOW_COPY_AND_ASSIGN(RecursiveGaussianDemonsFilter);
+
+    using Self = RecursiveGaussianDemonsFilter;
+    using Superclass = itk::DiffeomorphicDemonsRegistrationFilter<TImage, TImage, TField>;
+    using Pointer = itk::SmartPointer<Self>;
+    using ConstPointer = itk::SmartPointer<const Self>;
+
+    itkNewMacro(Self);
+    itkTypeMacro(RecursiveGaussianDemonsFilter, DiffeomorphicDemonsRegistrationFilter);
+
+protected:
+    RecursiveGaussianDemonsFilter() = default;
+    ~RecursiveGaussianDemonsFilter() override = default;
+
+    void SmoothDisplacementField() override
+    {
+        smoothInPlace(this->GetOutput(), this->GetStandardDeviations());
+    }
+
+    void SmoothUpdateField() override
+    {
+        smoothInPlace(this->GetUpdateBuffer(), this->GetUpdateFieldStandardDeviations());
+    }
+
+private:
+    // Smooth field in place; sigmas are in voxels, as for the stock filter.
+    void smoothInPlace(TField* field, const typename Superclass::StandardDeviationsType& sigmas)
+    {
+        using SmootherType = itk::SmoothingRecursiveGaussianImageFilter<TField, TField>;
+
+        // The recursive filter reads a copy while writing into the field buffer
+        if (!m_Scratch || m_Scratch->GetBufferedRegion() != field->GetBufferedRegion()) {
+            m_Scratch = TField::New();
+            m_Scratch->CopyInformation(field);
+            m_Scratch->SetRegions(field->GetBufferedRegion());
+            m_Scratch->Allocate();
+        }
+        itk::ImageAlgorithm::Copy(field, m_Scratch.GetPointer(), field->GetBufferedRegion(),
+                                  field->GetBufferedRegion());
+
+        typename SmootherType::SigmaArrayType sigmaArray;
+        for (unsigned int d = 0; d < TField::ImageDimension; ++d)
+            sigmaArray[d] = sigmas[d] * field->GetSpacing()[d];
+
+        auto smoother = SmootherType::New();
+        smoother->SetInput(m_Scratch);
+        smoother->SetSigmaArray(sigmaArray);
+        smoother->SetNumberOfWorkUnits(this->GetNumberOfWorkUnits());
+        smoother->GraftOutput(field);
+        smoother->Update();
+        // The pipeline may hand the grafted output a new buffer; graft it back so the field
+        // holds the smoothed values (as PDEDeformableRegistrationFilter::SmoothDeformationField)
+        field->Graft(smoother->GetOutput());
+    }
+
+    typename TField::Pointer m_Scratch;
+};
+
+// Multi-resolution diffeomorphic demons. Returns the (fixed -> moving) displacement field on
+// the fixed grid, or nullptr on failure.
+//
+// An optional initialTransform (typically the affine result) is sampled into the starting
+// field, so the returned field contains the whole mapping and the moving image is
+// interpolated once, by warpImage. stats, if given, receives the iterations run over all
+// levels and the final MSE.
+template <typename TImage>
+typename DisplacementFieldType<TImage::ImageDimension>::Pointer
+demonsRegister(const typename TImage::Pointer& fixed,
+               const typename TImage::Pointer& moving,
+               const DemonsParameters& params = {},
+               const itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension>*
+                   initialTransform = nullptr,
+               RegistrationStats* stats = nullptr)
+{
+    constexpr unsigned int Dim = TImage::ImageDimension;
+    using FieldType = DisplacementFieldType<Dim>;
+    using DemonsType = RecursiveGaussianDemonsFilter<TImage, FieldType>;
+    using MultiResType =
+        itk::MultiResolutionPDEDeformableRegistration<TImage, TImage, FieldType, float>;
+
+    typename TImage::Pointer movingInput = moving;
+    if (params.histogramMatch) {
+        using MatcherType = itk::HistogramMatchingImageFilter<TImage, TImage>;
+        auto matcher = MatcherType::New();
+        matcher->SetInput(moving);
+        matcher->SetReferenceImage(fixed);
+        matcher->SetNumberOfHistogramLevels(1024);
+        matcher->SetNumberOfMatchPoints(7);
+        matcher->ThresholdAtMeanIntensityOn();
+        matcher->Update();
+        movingInput = matcher->GetOutput();
+    }
+
+    auto demons = DemonsType::New();
+    demons->SetUseGradientType(itk::ESMDemonsRegistrationFunctionEnums::Gradient::Symmetric);
+    demons->SetMaximumUpdateStepLength(params.maxStepLength);
+    demons->SetStandardDeviations(params.fieldSigma);
+    demons->SetSmoothDisplacementField(params.fieldSigma > 0.0);
+    demons->SetUpdateFieldStandardDeviations(params.updateSigma);
+    demons->SetSmoothUpdateField(params.updateSigma > 0.0);
+
+    const unsigned int levels = std::max(1u, params.numberOfLevels);
+    std::vector<unsigned int> iterations(levels, params.iterations);
+
+    auto multires = MultiResType::New();
+    multires->SetRegistrationFilter(demons);
+    multires->SetNumberOfLevels(levels);
+    multires->SetNumberOfIterations(iterations);
+    multires->SetFixedImage(fixed);
+    multires->SetMovingImage(movingInput);
+    if (initialTransform) {
+        multires->SetArbitraryInitialDisplacementField(
+            computeDisplacementField<TImage>(initialTransform, fixed.GetPointer()));
+    }
+
+    auto levelStart = std::make_shared<std::chrono::steady_clock::time_point>(
+        std::chrono::steady_clock::now());
+    auto* demonsFilter = demons.GetPointer();
+    auto* multiresFilter = multires.GetPointer();
+    auto iterationsDone = std::make_shared<unsigned long>(0);
+    multires->AddObserver(itk::IterationEvent(), [=](const itk::EventObject&) {
+        const auto now = std::chrono::steady_clock::now();
+        *iterationsDone += demonsFilter->GetElapsedIterations();
+        // CurrentLevel has already been advanced when the event fires
+        std::cout << "   level " << multiresFilter->GetCurrentLevel() << "/" << levels << ": "
+                  << std::chrono::duration<double>(now - *levelStart).count()
+                  << " s, MSE = " << demonsFilter->GetMetric() << "\n";
+        *levelStart = now;
+    });
+
+    std::cout << "🚀 Diffeomorphic demons: levels = " << levels << ", iterations = "
+              << params.iterations << ", field sigma = " << params.fieldSigma << " vox\n";
+    try {
+        multires->Update();
+    } catch (const itk::ExceptionObject& e) {
+        std::cerr << "Demons registration failed: " << e << std::endl;
+        return nullptr;
+    }
+    std::cout << "✅ Demons registration finished.\n";
+    if (stats)
+        *stats = {*iterationsDone, demonsFilter->GetMetric()};
+    typename FieldType::Pointer field = multires->GetOutput();
+    field->DisconnectPipeline(); // see resampleToFixed
+    return field;
+}
+
+} // namespace itkexp
@@ -0,0 +1,91 @@
+#pragma once
+#include "itkImage.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkNearestNeighborInterpolateImageFunction.h"
+#include "itkTransform.h"
+#include "itkTransformToDisplacementFieldFilter.h"
+#include "itkVector.h"
+#include "itkWarpImageFilter.h"
+#include <iostream>
+#include <string>
+
+namespace itkexp
+{
+
+template <unsigned int Dim>
+using DisplacementFieldType = itk::Image<itk::Vector<float, Dim>, Dim>;
+
+// Sample a (fixed -> moving) transform at every voxel of the reference grid. The filter splits
+// the output into slabs along the last axis and evaluates them on all ITK threads, so a B-spline
+// or composite transform is evaluated exactly once per voxel.
+template <typename TImage>
+typename DisplacementFieldType<TImage::ImageDimension>::Pointer computeDisplacementField(
+    const itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension>* transform,
+    const TImage* reference)
+{
+    using FieldType = DisplacementFieldType<TImage::ImageDimension>;
+    using FilterType = itk::TransformToDisplacementFieldFilter<FieldType, double>;
+
+    auto filter = FilterType::New();
+    filter->SetTransform(transform);
+    filter->SetReferenceImage(reference);
+    filter->UseReferenceImageOn();
+    filter->Update();
+    typename FieldType::Pointer field = filter->GetOutput();
+    field->DisconnectPipeline(); // see resampleToFixed
+    return field;
+}
+
+// Write a displacement field (.nrrd or .mha keep the vector pixel type and geometry).
+template <unsigned int Dim>
+void writeDisplacementField(const typename DisplacementFieldType<Dim>::Pointer& field,
+                            const std::string& path)
+{
+    auto writer = itk::ImageFileWriter<DisplacementFieldType<Dim>>::New();
+    writer->SetFileName(path);
+    writer->SetInput(field);
+    writer->Update();
+    std::cout << "💾 Displacement field written: " << path << std::endl;
+}
+
+template <unsigned int Dim>
+typename DisplacementFieldType<Dim>::Pointer readDisplacementField(const std::string& path)
+{
+    auto reader = itk::ImageFileReader<DisplacementFieldType<Dim>>::New();
+    reader->SetFileName(path);
+    reader->Update();
+    return reader->GetOutput();
+}
+
+// Warp an image with a cached displacement field. The output takes the geometry of the field,
+// so WarpImageFilter reads the displacement of each voxel directly and only the input image is
+// interpolated (trilinear, or nearest neighbour for label maps).
+template <typename TImage>
+typename TImage::Pointer warpImage(
+    const typename TImage::Pointer& image,
+    const typename DisplacementFieldType<TImage::ImageDimension>::Pointer& field,
+    bool nearestNeighbor = false)
+{
+    using FieldType = DisplacementFieldType<TImage::ImageDimension>;
+    using NearestType = itk::NearestNeighborInterpolateImageFunction<TImage, double>;
+    using LinearType = itk::LinearInterpolateImageFunction<TImage, double>;
+    using WarpType = itk::WarpImageFilter<TImage, TImage, FieldType>;
+
+    auto warper = WarpType::New();
+    warper->SetInput(image);
+    warper->SetDisplacementField(field);
+    warper->SetOutputParametersFromImage(field);
+    warper->SetEdgePaddingValue(0);
+    if (nearestNeighbor)
+        warper->SetInterpolator(NearestType::New());
+    else
+        warper->SetInterpolator(LinearType::New());
+    warper->Update();
+    typename TImage::Pointer output = warper->GetOutput();
+    output->DisconnectPipeline(); // see resampleToFixed
+    return output;
+}
+
+} // namespace itkexp
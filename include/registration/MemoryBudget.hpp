@@ -0,0 +1,108 @@
+#pragma once
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include "itkImage.h"
+#include "itkNumericTraits.h"
+#include "registration/MultiResolution.hpp"
+
+namespace itkexp {
+
+    // Memory accounting for registration.
+    //
+    // The v4 registration framework keeps the fixed and moving images, a smoothed copy of each
+    // for the current level, the virtual domain of every level and (unless disabled) a cached
+    // gradient image of each fully in RAM.
+    // The estimates below size jobs and the reduced warm-start copies of the tiled path; the
+    // full-resolution registration within a ceiling is in registration/TiledMetric.hpp.
+
+    constexpr std::size_t MiB = std::size_t(1) << 20;
+
+    // Fraction of the ceiling given to the registration working set; the rest is left for the
+    // transform, metric buffers, the process itself and one streamed slab.
+    constexpr double kWorkingSetFraction = 0.75;
+
+    // Peak resident set size of this process so far, in MiB.
+    inline double peakResidentMiB()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024.0; // ru_maxrss is in KiB on Linux
+    }
+
+    // Bytes held per working-image voxel during a registration of `levels` pyramid levels:
+    // - the image itself
+    // - the smoothed copy of the current level, plus the RealType buffer of the recursive
+    //   Gaussian producing it; with several levels the previous level's copy is still held
+    //   while the next one is built
+    // - the virtual-domain image of every level, shrunk by 2 per axis and per coarser level
+    //   (full size at the finest level)
+    // - when the metric caches gradients, a CovariantVector<double> gradient image
+    template <typename TImage>
+    constexpr double registrationBytesPerVoxel(unsigned int levels, bool cachedGradients)
+    {
+        constexpr unsigned int Dim   = TImage::ImageDimension;
+        constexpr double       pixel = sizeof(typename TImage::PixelType);
+        using RealType = typename itk::NumericTraits<typename TImage::PixelType>::RealType;
+
+        levels = std::max(1u, levels);
+        double virtualDomains = 0.0;
+        for (unsigned int level = 0; level < levels; ++level)
+            virtualDomains += 1.0 / double(std::size_t(1) << (Dim * level));
+        const double smoothed = levels > 1 ? 2.0 : 1.0;
+        return (1.0 + smoothed + virtualDomains) * pixel + sizeof(RealType) +
+               (cachedGradients ? Dim * sizeof(double) : 0.0);
+    }
+
+    template <typename TImage>
+    double shrunkVoxelCount(const TImage* image,
+                            const itk::FixedArray<unsigned int, TImage::ImageDimension>& factors)
+    {
+        const auto& size = image->GetLargestPossibleRegion().GetSize();
+        double voxels = 1.0;
+        for (unsigned int d = 0; d < TImage::ImageDimension; ++d)
+            voxels *= std::max<itk::SizeValueType>(1, size[d] / factors[d]);
+        return voxels;
+    }
+
+    template <typename TImage>
+    double voxelCount(const TImage* image)
+    {
+        itk::FixedArray<unsigned int, TImage::ImageDimension> ones;
+        ones.Fill(1);
+        return shrunkVoxelCount(image, ones);
+    }
+
+    // Smallest nominal shrink factor at which both working images fit the ceiling, from
+    // geometry-only images (no pixels needed). Factors are chosen per axis from the spacing (see
+    // anisotropicShrinkFactors), so thick-slice axes are reduced last.
+    template <typename TImage>
+    unsigned int workingShrinkForCeiling(const TImage* fixed, const TImage* moving,
+                                         std::size_t ceilingBytes, unsigned int levels,
+                                         bool cachedGradients)
+    {
+        const double budget   = kWorkingSetFraction * ceilingBytes;
+        const double perVoxel = registrationBytesPerVoxel<TImage>(levels, cachedGradients);
+        double previousVoxels = 0.0;
+        for (unsigned int nominal = 1;; ++nominal) {
+            const double voxels =
+                shrunkVoxelCount(fixed, anisotropicShrinkFactors<TImage>(fixed, nominal)) +
+                shrunkVoxelCount(moving, anisotropicShrinkFactors<TImage>(moving, nominal));
+            if (voxels * perVoxel <= budget)
+                return nominal;
+
+            // anisotropicShrinkFactors keeps at least 8 voxels per axis; once the factors stop
+            // growing, no shrink fits
+            if (nominal > 1 && voxels >= previousVoxels)
+                throw std::runtime_error("Memory ceiling of " +
+                                         std::to_string(ceilingBytes / MiB) +
+                                         " MiB is too small for these images");
+            previousVoxels = voxels;
+        }
+    }
+
+} // namespace itkexp
@@ -36,13 +36,14 @@ namespace Registration {
      */
     struct RegistrationParameters
     {
-        unsigned int maxIterations    = 1000;
-        unsigned int pyramidLevels    = 3;
-        double       learningRate     = 0.001;
-        double       relaxationFactor = 0.95;
-        double       minStepLength    = 0.0001;
-        double       initialRadius    = 7e-05;  // For OnePlusOne optimizer
-        bool         verbose          = false;
+        unsigned int maxIterations     = 1000;
+        unsigned int pyramidLevels     = 3;
+        double       learningRate      = 0.001;
+        double       relaxationFactor  = 0.95;
+        double       minStepLength     = 0.0001;
+        double       initialRadius     = 7e-05;  // For OnePlusOne optimizer
+        bool         anisotropicShrink = true;   // Per-axis pyramid shrink factors from spacing
+        bool         verbose           = false;
     };
 
     /**
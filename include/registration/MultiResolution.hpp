@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "itkCommand.h"
+#include "itkFixedArray.h"
+#include "itkImage.h"
+#include "itkObjectToObjectOptimizerBase.h"
+
+namespace itkexp {
+
+    // Per-axis shrink factors for one pyramid level.
+    //
+    // The axis with the coarsest spacing is shrunk by nominalFactor; finer axes are shrunk more
+    // so the level ends up approximately isotropic at nominalFactor * maxSpacing. The finest
+    // level (nominalFactor == 1) is never shrunk, and no axis is reduced below minSize voxels.
+    template <typename TImage>
+    itk::FixedArray<unsigned int, TImage::ImageDimension>
+    anisotropicShrinkFactors(const TImage* image, unsigned int nominalFactor,
+                             unsigned int minSize = 8)
+    {
+        constexpr unsigned int Dim = TImage::ImageDimension;
+        itk::FixedArray<unsigned int, Dim> factors;
+        factors.Fill(1);
+        if (nominalFactor <= 1)
+            return factors;
+
+        const auto& spacing = image->GetSpacing();
+        const auto& size    = image->GetLargestPossibleRegion().GetSize();
+
+        double maxSpacing = 0.0;
+        for (unsigned int d = 0; d < Dim; ++d)
+            maxSpacing = std::max(maxSpacing, static_cast<double>(spacing[d]));
+
+        const double targetSpacing = maxSpacing * nominalFactor;
+        for (unsigned int d = 0; d < Dim; ++d) {
+            const auto wanted = static_cast<unsigned int>(std::lround(targetSpacing / spacing[d]));
+            const auto limit  = std::max<unsigned int>(1, size[d] / minSize);
+            factors[d]        = std::clamp<unsigned int>(wanted, 1, limit);
+        }
+        return factors;
+    }
+
+    // Configure an N-level pyramid on an ImageRegistrationMethodv4: nominal shrink
+    // 2^(N-1-level) and smoothing sigma (N-1-level) mm. With anisotropic = true the shrink
+    // factors are chosen per axis from the image spacing (see anisotropicShrinkFactors),
+    // otherwise every axis uses the nominal factor.
+    template <typename TRegistration, typename TImage>
+    void configurePyramid(TRegistration* registration, const TImage* image, unsigned int levels,
+                          bool anisotropic)
+    {
+        typename TRegistration::SmoothingSigmasArrayType smoothingSigmas;
+        smoothingSigmas.SetSize(levels);
+
+        // SetNumberOfLevels resets the per-level schedules, so it has to come first
+        registration->SetNumberOfLevels(levels);
+        for (unsigned int level = 0; level < levels; ++level) {
+            const unsigned int nominal = 1u << (levels - 1 - level);
+
+            typename TRegistration::ShrinkFactorsPerDimensionContainerType factors;
+            if (anisotropic)
+                factors = anisotropicShrinkFactors<TImage>(image, nominal);
+            else
+                factors.Fill(nominal);
+
+            registration->SetShrinkFactorsPerDimension(level, factors);
+            smoothingSigmas[level] = levels - 1 - level;
+        }
+        registration->SetSmoothingSigmasPerLevel(smoothingSigmas);
+        registration->SetSmoothingSigmasAreSpecifiedInPhysicalUnits(true);
+    }
+
+    // Print the shrink factors and voxel count of every pyramid level.
+    template <typename TRegistration, typename TImage>
+    void printPyramidSchedule(const TRegistration* registration, const TImage* image)
+    {
+        constexpr unsigned int Dim  = TImage::ImageDimension;
+        const auto&            size = image->GetLargestPossibleRegion().GetSize();
+
+        for (unsigned int level = 0; level < registration->GetNumberOfLevels(); ++level) {
+            const auto    factors = registration->GetShrinkFactorsPerDimension(level);
+            unsigned long voxels  = 1;
+            std::cout << "  Level " << level << ": shrink ";
+            for (unsigned int d = 0; d < Dim; ++d) {
+                voxels *= std::max<unsigned long>(1, size[d] / factors[d]);
+                std::cout << factors[d] << (d + 1 < Dim ? "x" : "");
+            }
+            std::cout << ", voxels " << voxels << std::endl;
+        }
+    }
+
+    // Optimizer summary of one registration, for run reports.
+    struct RegistrationStats
+    {
+        unsigned long iterations = 0;   // summed over all levels
+        double        metric     = 0.0; // final metric value
+    };
+
+    /**
+     * @brief Observer timing each level of a multi-resolution registration
+     *
+     * Attach to the registration method for itk::MultiResolutionIterationEvent and call Stop()
+     * once Update() returns to close the last level.
+     */
+    class LevelTimer : public itk::Command
+    {
+      public:
+        using Self          = LevelTimer;
+        using Superclass    = itk::Command;
+        using Pointer       = itk::SmartPointer<Self>;
+        using OptimizerType = itk::ObjectToObjectOptimizerBaseTemplate<double>;
+
+        itkNewMacro(Self);
+
+        void SetOptimizer(const OptimizerType* optimizer) { optimizer_ = optimizer; }
+
+        void Execute(itk::Object* caller, const itk::EventObject& event) override
+        {
+            Execute(static_cast<const itk::Object*>(caller), event);
+        }
+
+        void Execute(const itk::Object*, const itk::EventObject& event) override
+        {
+            if (!itk::MultiResolutionIterationEvent().CheckEvent(&event))
+                return;
+            Stop();
+            start_   = Clock::now();
+            running_ = true;
+        }
+
+        void Stop()
+        {
+            if (!running_)
+                return;
+            running_ = false;
+
+            const double seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+            const double value   = optimizer_ ? optimizer_->GetValue() : 0.0;
+            seconds_.push_back(seconds);
+            values_.push_back(value);
+            iterations_ += optimizer_ ? optimizer_->GetCurrentIteration() : 0;
+
+            std::cout << "  Level " << seconds_.size() - 1 << " done: " << std::fixed
+                      << std::setprecision(2) << seconds << " s, metric "
+                      << std::setprecision(6) << value << std::defaultfloat << std::endl;
+        }
+
+        const std::vector<double>& GetLevelSeconds() const { return seconds_; }
+        const std::vector<double>& GetLevelValues() const { return values_; }
+
+        RegistrationStats GetStats() const
+        {
+            return {iterations_, values_.empty() ? 0.0 : values_.back()};
+        }
+
+      protected:
+        LevelTimer() = default;
+
+      private:
+        using Clock = std::chrono::steady_clock;
+
+        const OptimizerType* optimizer_ = nullptr;
+        Clock::time_point    start_;
+        bool                 running_ = false;
+        std::vector<double>  seconds_;
+        std::vector<double>  values_;
+        unsigned long        iterations_ = 0;
+    };
+
+}  // namespace itkexp
@@ -7,26 +7,119 @@
 #include "itkAffineTransform.h"
 #include "itkImageFileWriter.h"
 #include "itkCastImageFilter.h"
+#include "itkCenteredTransformInitializer.h"
+#include "itkRegistrationParameterScalesFromPhysicalShift.h"
+#include "io/AsyncWriter.hpp"
+#include "registration/MultiResolution.hpp"
+#include <algorithm>
+#include <future>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace itkexp
 {
 
+// Resample moving onto the fixed image grid through transform (fixed -> moving mapping).
 template <typename TImage>
-typename TImage::Pointer registerImages(
+typename TImage::Pointer resampleToFixed(
     const typename TImage::Pointer& fixedImage,
     const typename TImage::Pointer& movingImage,
-    const std::string& outputPath)
+    const itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension>* transform)
+{
+    using ResampleType = itk::ResampleImageFilter<TImage, TImage>;
+    auto resampler = ResampleType::New();
+    resampler->SetInput(movingImage);
+    resampler->SetTransform(transform);
+    resampler->SetReferenceImage(fixedImage);
+    resampler->UseReferenceImageOn();
+    resampler->Update();
+    // Detached from the filter, so a later Update() (e.g. a writer on another thread) does not
+    // run the pipeline back into the fixed and moving images
+    typename TImage::Pointer output = resampler->GetOutput();
+    output->DisconnectPipeline();
+    return output;
+}
+
+struct AffineParameters
+{
+    unsigned int numberOfLevels = 3;                    // pyramid levels, coarse to fine
+    std::vector<unsigned int> iterations{200, 100, 50}; // per level; the last value repeats
+    bool anisotropicShrink = true;                      // per-axis shrink factors from spacing
+    bool estimateScales = true;                         // physical-shift parameter scales
+    bool centerInitialize = true;                       // rotate about the fixed image center
+    bool cacheGradients = true;                         // false: gradients on the fly (less RAM)
+    double learningRate = 1.0;                          // first step, mm with estimated scales
+    double minimumStepLength = 0.001;
+    double relaxationFactor = 0.5;
+};
+
+// The original single-level schedule: full resolution, 200 iterations, unscaled parameters.
+inline AffineParameters singleLevelAffineParameters()
+{
+    AffineParameters params;
+    params.numberOfLevels = 1;
+    params.iterations = {200};
+    params.estimateScales = false;
+    params.centerInitialize = false;
+    params.relaxationFactor = 0.7;
+    return params;
+}
+
+// Parse a per-level iteration schedule such as "200,100,50".
+inline std::vector<unsigned int> parseIterationSchedule(const std::string& text)
+{
+    std::vector<unsigned int> iterations;
+    std::size_t pos = 0;
+    while (pos < text.size())
+    {
+        const std::size_t comma = std::min(text.find(',', pos), text.size());
+        iterations.push_back(std::stoul(text.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+    if (iterations.empty())
+        throw std::invalid_argument("Empty iteration schedule '" + text + "'");
+    return iterations;
+}
+
+// Affine registration only; returns the optimized transform or nullptr on failure. When
+// stats is given it receives the iteration count and final metric.
+//
+// Runs Mean Squares over a smoothed, shrunk pyramid (see configurePyramid) so the coarse
+// levels do most of the work and the full-resolution level only refines. The 12 parameters
+// mix rotation/scale (unitless) and translation (mm); physical-shift scales make one step
+// move voxels by a comparable distance whichever parameter it changes.
+template <typename TImage>
+typename itk::AffineTransform<double, TImage::ImageDimension>::Pointer affineRegister(
+    const typename TImage::Pointer& fixedImage,
+    const typename TImage::Pointer& movingImage,
+    const AffineParameters& params = {},
+    RegistrationStats* stats = nullptr)
 {
     using TransformType = itk::AffineTransform<double, TImage::ImageDimension>;
     using MetricType = itk::MeanSquaresImageToImageMetricv4<TImage, TImage>;
     using OptimizerType = itk::RegularStepGradientDescentOptimizerv4<double>;
     using RegistrationType = itk::ImageRegistrationMethodv4<TImage, TImage, TransformType>;
+    using InitializerType = itk::CenteredTransformInitializer<TransformType, TImage, TImage>;
+    using ScalesEstimatorType = itk::RegistrationParameterScalesFromPhysicalShift<MetricType>;
 
     auto transform = TransformType::New();
     transform->SetIdentity();
+    if (params.centerInitialize)
+    {
+        // Center of rotation at the fixed image center, translation aligning the centers
+        auto initializer = InitializerType::New();
+        initializer->SetTransform(transform);
+        initializer->SetFixedImage(fixedImage);
+        initializer->SetMovingImage(movingImage);
+        initializer->GeometryOn();
+        initializer->InitializeTransform();
+    }
 
     auto metric = MetricType::New();
+    metric->SetUseFixedImageGradientFilter(params.cacheGradients);
+    metric->SetUseMovingImageGradientFilter(params.cacheGradients);
     auto optimizer = OptimizerType::New();
     auto registration = RegistrationType::New();
 
@@ -37,16 +130,51 @@ typename TImage::Pointer registerImages(
     registration->SetInitialTransform(transform);
     registration->InPlaceOn();
 
-    optimizer->SetLearningRate(1.0);
-    optimizer->SetMinimumStepLength(0.001);
-    optimizer->SetNumberOfIterations(200);
-    optimizer->SetRelaxationFactor(0.7);
+    optimizer->SetLearningRate(params.learningRate);
+    optimizer->SetMinimumStepLength(params.minimumStepLength);
+    optimizer->SetRelaxationFactor(params.relaxationFactor);
+    if (params.estimateScales)
+    {
+        auto scalesEstimator = ScalesEstimatorType::New();
+        scalesEstimator->SetMetric(metric);
+        scalesEstimator->SetTransformForward(true);
+        optimizer->SetScalesEstimator(scalesEstimator);
+        optimizer->SetDoEstimateScales(true);
+    }
+
+    const unsigned int levels = std::max(1u, params.numberOfLevels);
+    configurePyramid(registration.GetPointer(), fixedImage.GetPointer(), levels,
+                     params.anisotropicShrink);
+
+    // Iterations of each level, set when the level starts
+    auto iterationsAt = [&params](unsigned int level) {
+        if (params.iterations.empty())
+            return 200u;
+        return params.iterations[std::min<std::size_t>(level, params.iterations.size() - 1)];
+    };
+    optimizer->SetNumberOfIterations(iterationsAt(0));
+    auto* levelOptimizer = optimizer.GetPointer(); // raw: the registration owns the optimizer
+    auto* levelRegistration = registration.GetPointer();
+    registration->AddObserver(itk::MultiResolutionIterationEvent(),
+                              [=](const itk::EventObject&) {
+                                  levelOptimizer->SetNumberOfIterations(
+                                      iterationsAt(levelRegistration->GetCurrentLevel()));
+                              });
+
+    auto levelTimer = LevelTimer::New();
+    levelTimer->SetOptimizer(optimizer);
+    registration->AddObserver(itk::MultiResolutionIterationEvent(), levelTimer);
 
     try
     {
         std::cout << "🚀 Starting registration..." << std::endl;
+        if (levels > 1)
+            printPyramidSchedule(registration.GetPointer(), fixedImage.GetPointer());
         registration->Update();
+        levelTimer->Stop();
         std::cout << "✅ Registration finished." << std::endl;
+        if (stats)
+            *stats = levelTimer->GetStats();
     }
     catch (itk::ExceptionObject& e)
     {
@@ -54,25 +182,83 @@ typename TImage::Pointer registerImages(
         return nullptr;
     }
 
-    // Resample moving image
-    using ResampleType = itk::ResampleImageFilter<TImage, TImage>;
-    auto resampler = ResampleType::New();
-    resampler->SetInput(movingImage);
-    resampler->SetTransform(registration->GetTransform());
-    resampler->SetReferenceImage(fixedImage);
-    resampler->UseReferenceImageOn();
-    resampler->Update();
+    // InPlaceOn: the optimized transform is the initial transform object
+    return transform;
+}
 
-    auto registeredImage = resampler->GetOutput();
+// Result of an affine registration: the transform, plus the moving image resampled onto the
+// fixed grid on first use only. written is valid when an output was requested through an
+// AsyncWriter.
+template <typename TImage>
+struct AffineRegistrationResult
+{
+    using TransformType = itk::AffineTransform<double, TImage::ImageDimension>;
 
-    using WriterType = itk::ImageFileWriter<TImage>;
-    auto writer = WriterType::New();
-    writer->SetFileName(outputPath);
-    writer->SetInput(registeredImage);
-    writer->Update();
+    AffineRegistrationResult(const typename TImage::Pointer& fixedImage,
+                             const typename TImage::Pointer& movingImage)
+        : m_fixed(fixedImage), m_moving(movingImage)
+    {
+    }
+
+    typename TransformType::Pointer transform;
+    std::future<double> written; // seconds of the write
+
+    explicit operator bool() const { return transform.IsNotNull(); }
+
+    typename TImage::Pointer image()
+    {
+        if (!m_image && transform)
+            m_image = resampleToFixed<TImage>(m_fixed, m_moving, transform);
+        return m_image;
+    }
 
-    std::cout << "💾 Registered image written to: " << outputPath << std::endl;
-    return registeredImage;
+private:
+    typename TImage::Pointer m_fixed;
+    typename TImage::Pointer m_moving;
+    typename TImage::Pointer m_image;
+};
+
+// Affine registration without mandatory disk output. The image is only resampled when
+// image() is called or outputPath is given; with a writer the file is written on its
+// background thread (see result.written), otherwise synchronously.
+template <typename TImage>
+AffineRegistrationResult<TImage> registerAffine(
+    const typename TImage::Pointer& fixedImage,
+    const typename TImage::Pointer& movingImage,
+    const std::string& outputPath = {},
+    AsyncWriter* writer = nullptr,
+    const AffineParameters& params = {},
+    RegistrationStats* stats = nullptr)
+{
+    AffineRegistrationResult<TImage> result(fixedImage, movingImage);
+    result.transform = affineRegister<TImage>(fixedImage, movingImage, params, stats);
+    if (!result.transform || outputPath.empty())
+        return result;
+
+    if (writer)
+    {
+        result.written = writer->write(result.image(), outputPath);
+        std::cout << "💾 Queued for writing: " << outputPath << std::endl;
+    }
+    else
+    {
+        auto imageWriter = itk::ImageFileWriter<TImage>::New();
+        imageWriter->SetFileName(outputPath);
+        imageWriter->SetInput(result.image());
+        imageWriter->Update();
+        std::cout << "💾 Registered image written to: " << outputPath << std::endl;
+    }
+    return result;
+}
+
+template <typename TImage>
+typename TImage::Pointer registerImages(
+    const typename TImage::Pointer& fixedImage,
+    const typename TImage::Pointer& movingImage,
+    const std::string& outputPath)
+{
+    auto result = registerAffine<TImage>(fixedImage, movingImage, outputPath);
+    return result ? result.image() : nullptr;
 }
 
 } // namespace itkexp
@@ -0,0 +1,122 @@
+#pragma once
+#include "itkAffineTransform.h"
+#include "itkCenteredTransformInitializer.h"
+#include "itkImage.h"
+#include "itkImageDuplicator.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkNumericTraits.h"
+#include "registration/DisplacementField.hpp"
+#include "registration/Registration.hpp"
+#include <cmath>
+#include <cstddef>
+#include <mutex>
+
+namespace itkexp
+{
+
+// Running pixel-wise sum of images on one grid, for averages over many subjects that never
+// hold more than the sum and the image being added. Works for scalar images and for vector
+// images such as displacement fields. add() is thread-safe.
+template <typename TImage>
+class ImageAccumulator
+{
+public:
+    using PixelType = typename TImage::PixelType;
+    using ValueType = typename itk::NumericTraits<PixelType>::ValueType;
+
+    template <typename TGrid>
+    explicit ImageAccumulator(const TGrid* grid)
+    {
+        m_sum = TImage::New();
+        m_sum->CopyInformation(grid);
+        m_sum->SetRegions(grid->GetLargestPossibleRegion());
+        m_sum->Allocate();
+        m_sum->FillBuffer(itk::NumericTraits<PixelType>::ZeroValue());
+    }
+
+    // image must lie on the accumulator's grid.
+    void add(const TImage* image)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        itk::ImageRegionConstIterator<TImage> in(image, m_sum->GetLargestPossibleRegion());
+        itk::ImageRegionIterator<TImage> sum(m_sum, m_sum->GetLargestPossibleRegion());
+        for (; !sum.IsAtEnd(); ++sum, ++in)
+            sum.Set(sum.Get() + in.Get());
+        ++m_count;
+    }
+
+    std::size_t count() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_count;
+    }
+
+    // Sum times scale / count, as a new image.
+    typename TImage::Pointer mean(double scale = 1.0) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto duplicator = itk::ImageDuplicator<TImage>::New();
+        duplicator->SetInputImage(m_sum);
+        duplicator->Update();
+        typename TImage::Pointer mean = duplicator->GetOutput();
+
+        const auto factor = static_cast<ValueType>(m_count ? scale / m_count : 0.0);
+        itk::ImageRegionIterator<TImage> it(mean, mean->GetLargestPossibleRegion());
+        for (; !it.IsAtEnd(); ++it)
+            it.Set(it.Get() * factor);
+        return mean;
+    }
+
+private:
+    typename TImage::Pointer m_sum;
+    std::size_t m_count = 0;
+    mutable std::mutex m_mutex;
+};
+
+// Resample image onto reference's grid with the image centers aligned, the starting point of
+// a template when the subjects do not share a physical space.
+template <typename TImage>
+typename TImage::Pointer resampleCentered(const typename TImage::Pointer& reference,
+                                          const typename TImage::Pointer& image)
+{
+    using TransformType = itk::AffineTransform<double, TImage::ImageDimension>;
+    auto transform = TransformType::New();
+    auto initializer = itk::CenteredTransformInitializer<TransformType, TImage, TImage>::New();
+    initializer->SetTransform(transform);
+    initializer->SetFixedImage(reference);
+    initializer->SetMovingImage(image);
+    initializer->GeometryOn();
+    initializer->InitializeTransform();
+    return resampleToFixed<TImage>(reference, image, transform);
+}
+
+// Template update of one groupwise iteration. fields holds the displacements that map the
+// template onto each subject (template -> subject); their mean is the template's shape bias.
+// The averaged warped images are pulled back by -step * mean, a first-order inverse of the
+// average warp, so the template drifts towards the population mean shape.
+template <typename TImage>
+typename TImage::Pointer unbiasTemplate(
+    const typename TImage::Pointer& averageImage,
+    const ImageAccumulator<DisplacementFieldType<TImage::ImageDimension>>& fields, double step)
+{
+    auto inverseMean = fields.mean(-step);
+    return warpImage<TImage>(averageImage, inverseMean);
+}
+
+// Root-mean-square intensity difference of two images on the same grid.
+template <typename TImage>
+double rmsDifference(const TImage* a, const TImage* b)
+{
+    itk::ImageRegionConstIterator<TImage> ia(a, a->GetLargestPossibleRegion());
+    itk::ImageRegionConstIterator<TImage> ib(b, a->GetLargestPossibleRegion());
+    double sum = 0.0;
+    std::size_t n = 0;
+    for (; !ia.IsAtEnd(); ++ia, ++ib, ++n) {
+        const double d = static_cast<double>(ia.Get()) - ib.Get();
+        sum += d * d;
+    }
+    return n ? std::sqrt(sum / n) : 0.0;
+}
+
+} // namespace itkexp
@@ -0,0 +1,949 @@
+#pragma once
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "itkAffineTransform.h"
+#include "itkBinShrinkImageFilter.h"
+#include "itkBSplineTransform.h"
+#include "itkCompositeTransform.h"
+#include "itkImage.h"
+#include "itkImageAlgorithm.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageIOFactory.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageSource.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkMatrixOffsetTransformBase.h"
+#include "itkMultiThreaderBase.h"
+#include "itkResampleImageFilter.h"
+#include "io/ImageIO.hpp"
+#include "registration/BSplineRegistration.hpp"
+#include "registration/MemoryBudget.hpp"
+#include "registration/MultiResolution.hpp"
+#include "registration/Registration.hpp"
+
+namespace itkexp {
+
+    // Full-resolution registration within a memory ceiling.
+    //
+    // ImageRegistrationMethodv4 needs both images resident, so on volumes larger than the
+    // ceiling it can only run on reduced copies. The tiled path uses it for that (a warm start
+    // on copies reduced to fit) and then refines at full resolution with a Mean Squares metric
+    // evaluated block by block: the fixed grid is cut into blocks, and for each block only that
+    // block of the fixed file and the bounding box of its image in the moving file, grown by a
+    // halo for interpolation and the gradient stencil, are read. Value and derivative are
+    // summed over the blocks, so every iteration sees every full-resolution voxel while only
+    // one block, one moving box and the parameters are resident. The output is resampled block
+    // by block in the same way.
+    //
+    // Blocks are read with ImageIO::readRegion. Bricked .ixb volumes and uncompressed MetaImage
+    // files are read in place; any other format is first copied to a raw .mha in a scratch
+    // directory, slab by slab when its ImageIO reads regions (NIfTI, gzipped or not, does).
+
+    // Directory for scratch copies, removed with its content when destroyed. Put it next to the
+    // output: /tmp is often a RAM-backed tmpfs.
+    class ScratchDirectory
+    {
+      public:
+        explicit ScratchDirectory(const std::filesystem::path& parent)
+            : path_((parent.empty() ? std::filesystem::path(".") : parent) /
+                    (".itkexp-scratch-" + std::to_string(getpid())))
+        {
+            std::filesystem::create_directories(path_);
+        }
+        ScratchDirectory(const ScratchDirectory&)            = delete;
+        ScratchDirectory& operator=(const ScratchDirectory&) = delete;
+        ~ScratchDirectory()
+        {
+            std::error_code ec;
+            std::filesystem::remove_all(path_, ec);
+        }
+
+        const std::filesystem::path& path() const { return path_; }
+
+      private:
+        std::filesystem::path path_;
+    };
+
+    // True for a MetaImage (.mha/.mhd) storing its pixels uncompressed, which ITK reads region
+    // by region.
+    inline bool isRawMetaImage(const std::filesystem::path& path)
+    {
+        const auto extension = path.extension();
+        if (extension != ".mha" && extension != ".mhd")
+            return false;
+        std::ifstream in(path, std::ios::binary);
+        std::string   line;
+        while (std::getline(in, line) && line.rfind("ElementDataFile", 0) != 0) {
+            if (line.rfind("CompressedData", 0) == 0)
+                return line.find("True") == std::string::npos;
+        }
+        return static_cast<bool>(in);
+    }
+
+    // Image with the geometry of a file header and no pixel buffer.
+    template <typename TImage>
+    typename TImage::Pointer informationImage(const ImageInformation& info)
+    {
+        constexpr unsigned int Dim = TImage::ImageDimension;
+        if (info.dimension != Dim)
+            throw std::runtime_error(info.path.string() + " is not " + std::to_string(Dim) + "D");
+
+        typename TImage::SizeType      size;
+        typename TImage::SpacingType   spacing;
+        typename TImage::PointType     origin;
+        typename TImage::DirectionType direction;
+        for (unsigned int r = 0; r < Dim; ++r) {
+            size[r]    = info.size[r];
+            spacing[r] = info.spacing[r];
+            origin[r]  = info.origin[r];
+            for (unsigned int c = 0; c < Dim; ++c)
+                direction[r][c] = info.direction[c][r];
+        }
+        auto image = TImage::New();
+        image->SetRegions(size);
+        image->SetSpacing(spacing);
+        image->SetOrigin(origin);
+        image->SetDirection(direction);
+        return image;
+    }
+
+    /**
+     * @brief An image file read block by block
+     *
+     * Files that cannot be read region by region are copied once to `scratchFile` (a raw
+     * .mha), in slabs of at most slabBytes when their ImageIO streams. A format that does not
+     * stream is resident once, while it is copied. keepResident() holds the whole volume in
+     * memory for block() until release().
+     */
+    template <typename TImage>
+    class TiledVolume
+    {
+      public:
+        using RegionType = typename TImage::RegionType;
+
+        TiledVolume(const std::filesystem::path& path, const std::filesystem::path& scratchFile,
+                    std::size_t slabBytes)
+            : path_(path)
+        {
+            if (!isBricked(path) && !isRawMetaImage(path)) {
+                path_ = scratchFile;
+                copyToRawMetaImage(path, slabBytes);
+            }
+            info_ = informationImage<TImage>(readImageInformation(path_));
+        }
+
+        // Geometry only; the image has no pixels.
+        const TImage*     information() const { return info_.GetPointer(); }
+        const RegionType& largestRegion() const { return info_->GetLargestPossibleRegion(); }
+
+        typename TImage::Pointer read(const RegionType& region) const
+        {
+            return ImageIO<typename TImage::PixelType, TImage::ImageDimension>::readRegion(path_,
+                                                                                         region);
+        }
+
+        void keepResident()
+        {
+            if (!resident_)
+                resident_ = read(largestRegion());
+        }
+        void release() { resident_ = nullptr; }
+
+        // Pixels covering region: the resident volume when kept, otherwise read(region).
+        typename TImage::ConstPointer block(const RegionType& region) const
+        {
+            if (resident_)
+                return typename TImage::ConstPointer(resident_.GetPointer());
+            return typename TImage::ConstPointer(read(region).GetPointer());
+        }
+
+      private:
+        void copyToRawMetaImage(const std::filesystem::path& source, std::size_t slabBytes)
+        {
+            constexpr unsigned int Dim    = TImage::ImageDimension;
+            auto                   reader = itk::ImageFileReader<TImage>::New();
+            reader->SetFileName(source.string());
+            reader->UseStreamingOn();
+            reader->UpdateOutputInformation();
+            if (!reader->GetImageIO()->CanStreamRead())
+                std::cout << "⚠️ " << source.string() << " cannot be read in slabs; it is "
+                          << "resident once while it is copied\n";
+
+            const auto&  size  = reader->GetOutput()->GetLargestPossibleRegion().GetSize();
+            const double bytes = voxelCount(reader->GetOutput()) *
+                                 sizeof(typename TImage::PixelType);
+            const auto divisions = static_cast<unsigned int>(std::clamp<double>(
+                std::ceil(bytes / std::max<std::size_t>(slabBytes, 1)), 1.0, size[Dim - 1]));
+
+            auto writer = itk::ImageFileWriter<TImage>::New();
+            writer->SetInput(reader->GetOutput());
+            writer->SetFileName(path_.string());
+            writer->UseCompressionOff();
+            writer->SetNumberOfStreamDivisions(divisions);
+            writer->Update();
+            std::cout << "   " << source.string() << ": copied for block reads in " << divisions
+                      << " slabs\n";
+        }
+
+        std::filesystem::path    path_;
+        typename TImage::Pointer info_;
+        typename TImage::Pointer resident_;
+    };
+
+    // Read a volume reduced by per-axis factors derived from nominalShrink. Slabs of at most
+    // slabBytes, a whole number of bins thick, are read and bin-averaged one at a time, so only
+    // the reduced image and one input slab are resident.
+    template <typename TImage>
+    typename TImage::Pointer readShrunk(const TiledVolume<TImage>& volume,
+                                        unsigned int nominalShrink, std::size_t slabBytes)
+    {
+        constexpr unsigned int Dim        = TImage::ImageDimension;
+        using ShrinkType                  = itk::BinShrinkImageFilter<TImage, TImage>;
+        const TImage*          info       = volume.information();
+        const auto             factors    = anisotropicShrinkFactors<TImage>(info, nominalShrink);
+
+        // Geometry of the reduced image, from the header alone
+        auto geometry = ShrinkType::New();
+        geometry->SetInput(info);
+        geometry->SetShrinkFactors(factors);
+        geometry->UpdateOutputInformation();
+        auto output = TImage::New();
+        output->CopyInformation(geometry->GetOutput());
+        output->SetRegions(geometry->GetOutput()->GetLargestPossibleRegion());
+        output->Allocate();
+
+        // Trailing slices that do not fill a bin are dropped, as BinShrinkImageFilter does
+        const auto&        size       = volume.largestRegion().GetSize();
+        const unsigned int bin        = factors[Dim - 1];
+        const double       sliceBytes = voxelCount(info) / size[Dim - 1] *
+                                  sizeof(typename TImage::PixelType);
+        const auto thickness = bin * std::max<itk::SizeValueType>(
+                                         1, slabBytes / std::max(sliceBytes * bin, 1.0));
+        const auto   usable = size[Dim - 1] / bin * bin;
+        unsigned int slabs  = 0;
+        for (itk::SizeValueType start = 0; start < usable; start += thickness, ++slabs) {
+            auto slab = volume.largestRegion();
+            slab.SetIndex(Dim - 1, start);
+            slab.SetSize(Dim - 1, std::min(thickness, usable - start));
+
+            auto shrink = ShrinkType::New();
+            shrink->SetInput(volume.read(slab));
+            shrink->SetShrinkFactors(factors);
+            shrink->Update();
+            const auto& reduced = shrink->GetOutput()->GetLargestPossibleRegion();
+            itk::ImageAlgorithm::Copy(shrink->GetOutput(), output.GetPointer(), reduced, reduced);
+        }
+
+        std::cout << "   shrink {";
+        for (unsigned int d = 0; d < Dim; ++d)
+            std::cout << factors[d] << (d + 1 < Dim ? "," : "");
+        std::cout << "} in " << slabs << " slabs\n";
+        return output;
+    }
+
+    // Parameter models of the tiled metric. map() takes a fixed point to the moving image;
+    // accumulate() adds g . dT/dp at a fixed point x to derivative[p] for a physical vector g;
+    // scales() are the squared physical shifts of a unit step of each parameter.
+
+    // itk::AffineTransform, T(x) = A (x - c) + c + t; parameters are A row by row, then t.
+    template <unsigned int Dim>
+    class TiledAffineModel
+    {
+      public:
+        using TransformType = itk::AffineTransform<double, Dim>;
+        using PointType     = typename TransformType::InputPointType;
+        using VectorType    = itk::Vector<double, Dim>;
+
+        explicit TiledAffineModel(TransformType* transform) : transform_(transform) {}
+
+        TransformType* transform() const { return transform_; }
+
+        PointType map(const PointType& x) const { return transform_->TransformPoint(x); }
+
+        void accumulate(const PointType& x, const VectorType& g, double* derivative) const
+        {
+            const auto& center = transform_->GetCenter();
+            for (unsigned int i = 0; i < Dim; ++i) {
+                for (unsigned int j = 0; j < Dim; ++j)
+                    derivative[i * Dim + j] += g[i] * (x[j] - center[j]);
+                derivative[Dim * Dim + i] += g[i];
+            }
+        }
+
+        // Largest shift over the corners of the domain
+        std::vector<double> scales(const itk::ImageBase<Dim>* domain) const
+        {
+            std::vector<double> scales(transform_->GetNumberOfParameters(), 1.0);
+            const auto&         center = transform_->GetCenter();
+            const auto&         region = domain->GetLargestPossibleRegion();
+            for (unsigned int corner = 0; corner < (1u << Dim); ++corner) {
+                typename itk::ImageBase<Dim>::IndexType index = region.GetIndex();
+                for (unsigned int d = 0; d < Dim; ++d)
+                    if (corner & (1u << d))
+                        index[d] += region.GetSize(d) - 1;
+                PointType x;
+                domain->TransformIndexToPhysicalPoint(index, x);
+                for (unsigned int i = 0; i < Dim; ++i)
+                    for (unsigned int j = 0; j < Dim; ++j) {
+                        const double shift = (x[j] - center[j]) * (x[j] - center[j]);
+                        scales[i * Dim + j] = std::max(scales[i * Dim + j], shift);
+                    }
+            }
+            return scales;
+        }
+
+      private:
+        TransformType* transform_;
+    };
+
+    // Gives a B-spline weights buffer n entries. BSplineTransform::WeightsType is an itk::Array
+    // in ITK 5.2, sized at run time; later releases made it a FixedArray, already sized.
+    template <typename TWeights>
+    void sizeBSplineWeights(TWeights& weights, unsigned int n)
+    {
+        if (weights.Size() != n)
+            weights.SetSize(n);
+    }
+
+    template <typename T, unsigned int N>
+    void sizeBSplineWeights(itk::FixedArray<T, N>&, unsigned int)
+    {
+    }
+
+    // A B-spline followed by a fixed affine, T(x) = A(B(x)), as bsplineRegisterTransform chains
+    // them. Only the B-spline coefficients are parameters; they are in mm, so unscaled.
+    template <unsigned int Dim, unsigned int SplineOrder = 3>
+    class TiledBSplineModel
+    {
+      public:
+        using TransformType = itk::BSplineTransform<double, Dim, SplineOrder>;
+        using AffineType    = itk::MatrixOffsetTransformBase<double, Dim, Dim>;
+        using PointType     = typename TransformType::InputPointType;
+        using VectorType    = itk::Vector<double, Dim>;
+
+        TiledBSplineModel(TransformType* bspline, const AffineType* affine)
+            : bspline_(bspline), affine_(affine)
+        {
+        }
+
+        TransformType* transform() const { return bspline_; }
+
+        PointType map(const PointType& x) const
+        {
+            const PointType y = bspline_->TransformPoint(x);
+            return affine_ ? affine_->TransformPoint(y) : y;
+        }
+
+        void accumulate(const PointType& x, const VectorType& g, double* derivative) const
+        {
+            // The gradient is pulled back through the affine: dT/dc = A dB/dc
+            VectorType h = g;
+            if (affine_) {
+                const auto& a = affine_->GetMatrix();
+                for (unsigned int j = 0; j < Dim; ++j) {
+                    h[j] = 0.0;
+                    for (unsigned int i = 0; i < Dim; ++i)
+                        h[j] += a[i][j] * g[i];
+                }
+            }
+
+            thread_local typename TransformType::WeightsType             weights;
+            thread_local typename TransformType::ParameterIndexArrayType indices;
+            const unsigned int n = bspline_->GetNumberOfWeights();
+            sizeBSplineWeights(weights, n);
+            if (indices.Size() != n)
+                indices.SetSize(n);
+            bspline_->ComputeJacobianFromBSplineWeightsToIndex(x, weights, indices);
+
+            const auto perDimension = bspline_->GetNumberOfParametersPerDimension();
+            for (unsigned int k = 0; k < n; ++k)
+                for (unsigned int d = 0; d < Dim; ++d)
+                    derivative[indices[k] + d * perDimension] += h[d] * weights[k];
+        }
+
+        std::vector<double> scales(const itk::ImageBase<Dim>*) const
+        {
+            return std::vector<double>(bspline_->GetNumberOfParameters(), 1.0);
+        }
+
+      private:
+        TransformType*    bspline_;
+        const AffineType* affine_;
+    };
+
+    // How the fixed grid is cut.
+    struct TileLayout
+    {
+        unsigned int edge            = 64; // fixed block edge, voxels
+        double       maxMovingVoxels = 0;  // blocks whose moving box is larger are halved
+        unsigned int halo            = 2;  // voxels around the mapped block
+        unsigned int threads         = 1;
+    };
+
+    // Splits kWorkingSetFraction of the ceiling: the parameters, one derivative buffer per
+    // thread and residentBytes (a volume kept in memory) first, then a third of the rest for the
+    // fixed block and two thirds for its moving box (which is larger when the transform rotates
+    // or scales).
+    template <typename TImage>
+    TileLayout tileLayoutForCeiling(std::size_t ceilingBytes, std::size_t parameters,
+                                    double residentBytes = 0.0)
+    {
+        constexpr double pixel = sizeof(typename TImage::PixelType);
+        TileLayout       layout;
+        layout.threads = std::max(1u, itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads());
+
+        const double reserved = (layout.threads + 4.0) * parameters * sizeof(double);
+        const double budget   = kWorkingSetFraction * ceilingBytes - reserved - residentBytes;
+        const double edge     = std::floor(std::cbrt(std::max(budget, 0.0) / 3.0 / pixel));
+        if (edge < 16)
+            throw std::runtime_error("Memory ceiling of " + std::to_string(ceilingBytes / MiB) +
+                                     " MiB is too small for tiled registration");
+        layout.edge            = static_cast<unsigned int>(edge);
+        layout.maxMovingVoxels = 2.0 * budget / 3.0 / pixel;
+        return layout;
+    }
+
+    // Cut region into blocks of at most edge voxels per axis.
+    template <typename TImage>
+    std::vector<typename TImage::RegionType> regionBlocks(const typename TImage::RegionType& region,
+                                                          unsigned int edge)
+    {
+        constexpr unsigned int                   Dim = TImage::ImageDimension;
+        std::vector<typename TImage::RegionType> blocks;
+        if (region.GetNumberOfPixels() == 0)
+            return blocks;
+        std::array<itk::SizeValueType, Dim> at{};
+        for (;;) {
+            typename TImage::RegionType block;
+            for (unsigned int d = 0; d < Dim; ++d) {
+                block.SetIndex(d, region.GetIndex(d) + at[d]);
+                block.SetSize(d, std::min<itk::SizeValueType>(edge, region.GetSize(d) - at[d]));
+            }
+            blocks.push_back(block);
+
+            unsigned int d = 0;
+            while (d < Dim && (at[d] += edge) >= region.GetSize(d))
+                at[d++] = 0;
+            if (d == Dim)
+                return blocks;
+        }
+    }
+
+    // Region of `moving` that the block of `fixed` maps into through map(), grown by halo and
+    // clipped to the image. Mapped from a lattice of points over the block, which bounds it
+    // for affine maps and for B-splines without folding. False if the block maps outside.
+    template <typename TImage, typename TMap>
+    bool movingBox(const TImage* fixed, const TImage* moving, const TMap& map,
+                   const typename TImage::RegionType& block, unsigned int halo,
+                   typename TImage::RegionType& box)
+    {
+        constexpr unsigned int Dim = TImage::ImageDimension;
+
+        std::array<std::vector<itk::IndexValueType>, Dim> ticks;
+        for (unsigned int d = 0; d < Dim; ++d) {
+            const itk::IndexValueType first = block.GetIndex(d);
+            const itk::IndexValueType last  = first + block.GetSize(d) - 1;
+            const itk::IndexValueType step  = std::max<itk::IndexValueType>(1, (last - first) / 4);
+            for (auto v = first; v < last; v += step)
+                ticks[d].push_back(v);
+            ticks[d].push_back(last);
+        }
+
+        std::array<double, Dim> lo, hi;
+        lo.fill(std::numeric_limits<double>::max());
+        hi.fill(std::numeric_limits<double>::lowest());
+        std::array<std::size_t, Dim> at{};
+        for (;;) {
+            typename TImage::IndexType index;
+            for (unsigned int d = 0; d < Dim; ++d)
+                index[d] = ticks[d][at[d]];
+            typename TImage::PointType x;
+            fixed->TransformIndexToPhysicalPoint(index, x);
+            itk::ContinuousIndex<double, Dim> mapped;
+            moving->TransformPhysicalPointToContinuousIndex(map(x), mapped);
+            for (unsigned int d = 0; d < Dim; ++d) {
+                lo[d] = std::min(lo[d], mapped[d]);
+                hi[d] = std::max(hi[d], mapped[d]);
+            }
+
+            unsigned int d = 0;
+            while (d < Dim && ++at[d] == ticks[d].size())
+                at[d++] = 0;
+            if (d == Dim)
+                break;
+        }
+
+        const auto& largest = moving->GetLargestPossibleRegion();
+        for (unsigned int d = 0; d < Dim; ++d) {
+            const double first = largest.GetIndex(d);
+            const double last  = first + largest.GetSize(d) - 1.0;
+            const double from  = std::max(first, std::floor(lo[d]) - halo);
+            const double to    = std::min(last, std::ceil(hi[d]) + halo);
+            if (from > to)
+                return false;
+            box.SetIndex(d, static_cast<itk::IndexValueType>(from));
+            box.SetSize(d, static_cast<itk::SizeValueType>(to - from + 1));
+        }
+        return true;
+    }
+
+    // One block of the fixed grid with the moving box it needs.
+    template <typename TImage>
+    struct Tile
+    {
+        typename TImage::RegionType fixed;
+        typename TImage::RegionType moving;
+    };
+
+    // Tiles covering region; blocks whose moving box exceeds the layout's limit are halved
+    // along their longest axis until it fits. Blocks mapping outside the moving image are left
+    // out.
+    template <typename TImage, typename TMap>
+    std::vector<Tile<TImage>> tilesFor(const TImage* fixed, const TImage* moving, const TMap& map,
+                                       const typename TImage::RegionType& region,
+                                       const TileLayout& layout)
+    {
+        std::vector<Tile<TImage>>                tiles;
+        std::vector<typename TImage::RegionType> pending =
+            regionBlocks<TImage>(region, layout.edge);
+        while (!pending.empty()) {
+            const auto block = pending.back();
+            pending.pop_back();
+            typename TImage::RegionType box;
+            if (!movingBox(fixed, moving, map, block, layout.halo, box))
+                continue;
+
+            unsigned int longest = 0;
+            for (unsigned int d = 1; d < TImage::ImageDimension; ++d)
+                if (block.GetSize(d) > block.GetSize(longest))
+                    longest = d;
+            if (box.GetNumberOfPixels() <= layout.maxMovingVoxels || block.GetSize(longest) < 2) {
+                tiles.push_back({block, box});
+                continue;
+            }
+            auto first  = block;
+            auto second = block;
+            first.SetSize(longest, block.GetSize(longest) / 2);
+            second.SetIndex(longest, block.GetIndex(longest) + first.GetSize(longest));
+            second.SetSize(longest, block.GetSize(longest) - first.GetSize(longest));
+            pending.push_back(first);
+            pending.push_back(second);
+        }
+        return tiles;
+    }
+
+    // Mean squares between the fixed volume and the moving volume mapped through the model,
+    // over the full-resolution fixed grid, evaluated tile by tile on layout.threads threads.
+    // Returns the value and sets derivative[p] = d value / d p. Fixed voxels mapping outside
+    // the moving image are left out, as in the v4 metrics; validPoints, if given, counts the
+    // others.
+    template <typename TImage, typename TModel>
+    double tiledMeanSquares(const TiledVolume<TImage>& fixed, const TiledVolume<TImage>& moving,
+                            const TModel& model, const TileLayout& layout,
+                            std::vector<double>& derivative, std::size_t* validPoints = nullptr)
+    {
+        constexpr unsigned int Dim = TImage::ImageDimension;
+        using PointType            = typename TModel::PointType;
+        using InterpolatorType     = itk::LinearInterpolateImageFunction<TImage, double>;
+
+        const std::size_t                parameters = model.transform()->GetNumberOfParameters();
+        const unsigned int               threads    = std::max(1u, layout.threads);
+        std::vector<std::vector<double>> partial(threads, std::vector<double>(parameters, 0.0));
+        std::vector<double>              sums(threads, 0.0);
+        std::vector<std::size_t>         counts(threads, 0);
+
+        const auto map = [&model](const PointType& x) { return model.map(x); };
+        for (const auto& tile : tilesFor(fixed.information(), moving.information(), map,
+                                         fixed.largestRegion(), layout)) {
+            const auto fixedPixels  = fixed.block(tile.fixed);
+            const auto movingPixels = moving.read(tile.moving);
+            auto       interpolator = InterpolatorType::New();
+            interpolator->SetInputImage(movingPixels);
+
+            // Index-space gradient to physical: D diag(1/spacing)
+            const auto& direction = movingPixels->GetDirection();
+            const auto& spacing   = movingPixels->GetSpacing();
+            const auto& box       = tile.moving;
+
+            auto work = [&](unsigned int t, const typename TImage::RegionType& part) {
+                double      sum   = 0.0;
+                std::size_t count = 0;
+                double*     d     = partial[t].data();
+                for (itk::ImageRegionConstIteratorWithIndex<TImage> it(fixedPixels, part);
+                     !it.IsAtEnd(); ++it) {
+                    PointType x;
+                    fixedPixels->TransformIndexToPhysicalPoint(it.GetIndex(), x);
+                    itk::ContinuousIndex<double, Dim> c;
+                    movingPixels->TransformPhysicalPointToContinuousIndex(model.map(x), c);
+
+                    // The central difference needs c +- 1 inside the box
+                    bool inside = true;
+                    for (unsigned int k = 0; k < Dim && inside; ++k)
+                        inside = c[k] - 1.0 >= box.GetIndex(k) &&
+                                 c[k] + 1.0 <= box.GetIndex(k) + box.GetSize(k) - 1.0;
+                    if (!inside)
+                        continue;
+
+                    itk::Vector<double, Dim> indexGradient;
+                    for (unsigned int k = 0; k < Dim; ++k) {
+                        auto below = c, above = c;
+                        below[k] -= 1.0;
+                        above[k] += 1.0;
+                        indexGradient[k] = 0.5 * (interpolator->EvaluateAtContinuousIndex(above) -
+                                                  interpolator->EvaluateAtContinuousIndex(below));
+                    }
+                    itk::Vector<double, Dim> g;
+                    for (unsigned int r = 0; r < Dim; ++r) {
+                        g[r] = 0.0;
+                        for (unsigned int k = 0; k < Dim; ++k)
+                            g[r] += direction[r][k] * indexGradient[k] / spacing[k];
+                    }
+
+                    const double diff = interpolator->EvaluateAtContinuousIndex(c) - it.Get();
+                    sum += diff * diff;
+                    ++count;
+                    model.accumulate(x, g * (2.0 * diff), d);
+                }
+                sums[t] += sum;
+                counts[t] += count;
+            };
+
+            // Slabs of the block along its last axis, one per thread
+            const auto   region = tile.fixed;
+            const auto   depth  = region.GetSize(Dim - 1);
+            const auto   used   = std::min<itk::SizeValueType>(threads, depth);
+            std::vector<std::thread> workers;
+            for (unsigned int t = 0; t < used; ++t) {
+                auto part = region;
+                part.SetIndex(Dim - 1, region.GetIndex(Dim - 1) + t * depth / used);
+                part.SetSize(Dim - 1, (t + 1) * depth / used - t * depth / used);
+                workers.emplace_back(work, t, part);
+            }
+            for (auto& worker : workers)
+                worker.join();
+        }
+
+        double      sum   = 0.0;
+        std::size_t count = 0;
+        for (unsigned int t = 0; t < threads; ++t) {
+            sum += sums[t];
+            count += counts[t];
+        }
+        if (count == 0)
+            throw std::runtime_error("No fixed voxel maps inside the moving image");
+
+        derivative.assign(parameters, 0.0);
+        for (const auto& part : partial)
+            for (std::size_t p = 0; p < parameters; ++p)
+                derivative[p] += part[p] / count;
+        if (validPoints)
+            *validPoints = count;
+        return sum / count;
+    }
+
+    struct TiledParameters
+    {
+        unsigned int iterations        = 30;  // full-resolution passes
+        double       learningRate      = 1.0; // first step, mm with the model's scales
+        double       minimumStepLength = 0.01;
+        double       relaxationFactor  = 0.5;
+    };
+
+    // Regular-step gradient descent on tiledMeanSquares, as RegularStepGradientDescentOptimizerv4
+    // does it: a step of fixed length along the scaled gradient, shrunk by relaxationFactor
+    // whenever the direction turns back. Each iteration is one full-resolution pass, which reads
+    // every moving box from disk again (the boxes follow the transform), and the fixed blocks
+    // too unless the fixed volume is resident (see residentFixedLayout). The model's transform
+    // is updated in place.
+    template <typename TImage, typename TModel>
+    RegistrationStats tiledRegister(const TiledVolume<TImage>& fixed,
+                                    const TiledVolume<TImage>& moving, const TModel& model,
+                                    const TileLayout& layout, const TiledParameters& params = {})
+    {
+        auto*             transform  = model.transform();
+        const std::size_t parameters = transform->GetNumberOfParameters();
+        const auto        scales     = model.scales(fixed.information());
+
+        std::vector<double> direction(parameters), previous(parameters, 0.0);
+        typename TModel::TransformType::DerivativeType update(parameters);
+        double            step = params.learningRate;
+        RegistrationStats stats;
+        for (unsigned int iteration = 0; iteration < params.iterations; ++iteration) {
+            const auto  start = std::chrono::steady_clock::now();
+            std::size_t valid = 0;
+            stats.metric = tiledMeanSquares(fixed, moving, model, layout, direction, &valid);
+            stats.iterations = iteration + 1;
+
+            double norm = 0.0, turn = 0.0;
+            for (std::size_t p = 0; p < parameters; ++p) {
+                direction[p] = -direction[p] / scales[p];
+                norm += direction[p] * direction[p];
+                turn += direction[p] * previous[p];
+            }
+            norm = std::sqrt(norm);
+            if (turn < 0.0)
+                step *= params.relaxationFactor;
+
+            std::cout << "   Iteration " << iteration << ": MSE " << stats.metric << " over "
+                      << valid << " voxels, step " << step << ", "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                             .count()
+                      << " s\n";
+            if (norm == 0.0 || step < params.minimumStepLength)
+                break;
+
+            for (std::size_t p = 0; p < parameters; ++p)
+                update[p] = step * direction[p] / norm;
+            transform->UpdateTransformParameters(update);
+            previous.swap(direction);
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Resamples a moving volume onto a fixed grid block by block
+     *
+     * For each block of the requested region only the moving box it maps into is read. Driven
+     * by a writer that streams, one output slab and one moving box are resident.
+     */
+    template <typename TImage>
+    class TiledResampleSource : public itk::ImageSource<TImage>
+    {
+      public:
+        using Self          = TiledResampleSource;
+        using Superclass    = itk::ImageSource<TImage>;
+        using Pointer       = itk::SmartPointer<Self>;
+        using TransformType = itk::Transform<double, TImage::ImageDimension,
+                                             TImage::ImageDimension>;
+
+        itkNewMacro(Self);
+        itkTypeMacro(TiledResampleSource, ImageSource);
+
+        void SetVolumes(const TiledVolume<TImage>* fixed, const TiledVolume<TImage>* moving)
+        {
+            fixed_  = fixed;
+            moving_ = moving;
+            this->Modified();
+        }
+        void SetTransform(const TransformType* transform)
+        {
+            transform_ = transform;
+            this->Modified();
+        }
+        void SetLayout(const TileLayout& layout) { layout_ = layout; }
+
+      protected:
+        TiledResampleSource() = default;
+
+        void GenerateOutputInformation() override
+        {
+            this->GetOutput()->CopyInformation(fixed_->information());
+        }
+
+        void GenerateData() override
+        {
+            this->AllocateOutputs();
+            TImage*    output    = this->GetOutput();
+            const auto requested = output->GetRequestedRegion();
+            output->FillBuffer(0);
+
+            const auto map = [this](const typename TImage::PointType& x) {
+                return transform_->TransformPoint(x);
+            };
+            for (const auto& tile : tilesFor(fixed_->information(), moving_->information(), map,
+                                             requested, layout_)) {
+                auto resampler = itk::ResampleImageFilter<TImage, TImage>::New();
+                resampler->SetInput(moving_->read(tile.moving));
+                resampler->SetTransform(transform_);
+                resampler->SetOutputOrigin(output->GetOrigin());
+                resampler->SetOutputSpacing(output->GetSpacing());
+                resampler->SetOutputDirection(output->GetDirection());
+                resampler->SetOutputStartIndex(tile.fixed.GetIndex());
+                resampler->SetSize(tile.fixed.GetSize());
+                resampler->SetDefaultPixelValue(0);
+                resampler->Update();
+                itk::ImageAlgorithm::Copy(resampler->GetOutput(), output, tile.fixed, tile.fixed);
+            }
+        }
+
+      private:
+        const TiledVolume<TImage>* fixed_  = nullptr;
+        const TiledVolume<TImage>* moving_ = nullptr;
+        const TransformType*       transform_ = nullptr;
+        TileLayout                 layout_;
+    };
+
+    // True when the writer for outputPath streams (uncompressed MetaImage), so it holds one slab
+    // of the output. Others hold the whole output; they are refused when it would not fit the
+    // ceiling. Check before registering, so a long run does not fail when writing.
+    template <typename TImage>
+    bool checkTiledOutput(const TImage* fixedInformation, const std::string& outputPath,
+                          std::size_t ceilingBytes)
+    {
+        auto io = itk::ImageIOFactory::CreateImageIO(outputPath.c_str(),
+                                                     itk::IOFileModeEnum::WriteMode);
+        if (!io)
+            throw std::runtime_error("No image writer for " + outputPath);
+        if (io->CanStreamWrite())
+            return true;
+        const double outputBytes =
+            voxelCount(fixedInformation) * sizeof(typename TImage::PixelType);
+        if (outputBytes > kWorkingSetFraction * ceilingBytes)
+            throw std::runtime_error(outputPath + " cannot be written in slabs and the whole " +
+                                     "output (" + std::to_string(std::size_t(outputBytes / MiB)) +
+                                     " MiB) does not fit the memory ceiling; write .mha");
+        return false;
+    }
+
+    // Write moving resampled onto the full fixed grid through transform, in slabs when the
+    // writer streams (see checkTiledOutput).
+    template <typename TImage>
+    void writeTiledResampled(
+        const TiledVolume<TImage>& fixed, const TiledVolume<TImage>& moving,
+        const itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension>* transform,
+        const TileLayout& layout, const std::string& outputPath, std::size_t ceilingBytes)
+    {
+        constexpr unsigned int Dim   = TImage::ImageDimension;
+        constexpr double       pixel = sizeof(typename TImage::PixelType);
+
+        auto source = TiledResampleSource<TImage>::New();
+        source->SetVolumes(&fixed, &moving);
+        source->SetTransform(transform);
+        source->SetLayout(layout);
+
+        auto writer = itk::ImageFileWriter<TImage>::New();
+        writer->SetInput(source->GetOutput());
+        writer->SetFileName(outputPath);
+        if (checkTiledOutput(fixed.information(), outputPath, ceilingBytes)) {
+            const double outputBytes = voxelCount(fixed.information()) * pixel;
+            const double slabBytes   = std::pow(double(layout.edge), Dim) * pixel;
+            writer->SetNumberOfStreamDivisions(static_cast<unsigned int>(
+                std::clamp<double>(std::ceil(outputBytes / slabBytes), 1.0,
+                                   fixed.largestRegion().GetSize(Dim - 1))));
+        }
+        writer->Update();
+    }
+
+    // Layout of the full-resolution passes. A fixed volume taking at most half of the working
+    // set is kept resident, since its blocks are the same on every pass, and the blocks are cut
+    // from what is left; otherwise the fixed blocks are read again on every pass too.
+    template <typename TImage>
+    TileLayout residentFixedLayout(TiledVolume<TImage>& fixed, std::size_t ceilingBytes,
+                                   std::size_t parameters)
+    {
+        const double fixedBytes =
+            voxelCount(fixed.information()) * sizeof(typename TImage::PixelType);
+        if (fixedBytes <= 0.5 * kWorkingSetFraction * ceilingBytes) {
+            try {
+                const auto layout =
+                    tileLayoutForCeiling<TImage>(ceilingBytes, parameters, fixedBytes);
+                fixed.keepResident();
+                std::cout << "   Fixed volume resident (" << fixedBytes / MiB
+                          << " MiB): each pass reads the moving boxes\n";
+                return layout;
+            } catch (const std::runtime_error&) {
+                // too little left for blocks next to it
+            }
+        }
+        std::cout << "   Each pass reads the fixed blocks and moving boxes from disk\n";
+        return tileLayoutForCeiling<TImage>(ceilingBytes, parameters);
+    }
+
+    // Affine registration within ceilingBytes: the usual pyramid (params) on copies reduced to
+    // fit the ceiling, at least by 2, then `tiled` full-resolution iterations.
+    template <typename TImage>
+    typename itk::AffineTransform<double, TImage::ImageDimension>::Pointer
+    tiledAffineRegister(TiledVolume<TImage>& fixed, const TiledVolume<TImage>& moving,
+                        std::size_t ceilingBytes, AffineParameters params = {},
+                        const TiledParameters& tiled = {})
+    {
+        params.cacheGradients = false;
+        const unsigned int shrink = std::max(
+            2u, workingShrinkForCeiling(fixed.information(), moving.information(), ceilingBytes,
+                                        params.numberOfLevels, params.cacheGradients));
+        std::cout << "🧮 Affine warm start at shrink " << shrink << "\n";
+        typename itk::AffineTransform<double, TImage::ImageDimension>::Pointer transform;
+        {
+            auto fixedWorking  = readShrunk(fixed, shrink, ceilingBytes / 8);
+            auto movingWorking = readShrunk(moving, shrink, ceilingBytes / 8);
+            transform = affineRegister<TImage>(fixedWorking, movingWorking, params);
+        }
+        if (!transform)
+            return nullptr;
+        if (tiled.iterations == 0)
+            return transform;
+
+        const TiledAffineModel<TImage::ImageDimension> model(transform);
+        std::cout << "🧩 Full-resolution affine refinement\n";
+        const auto layout =
+            residentFixedLayout(fixed, ceilingBytes, transform->GetNumberOfParameters());
+        std::cout << "   " << layout.edge << "^" << TImage::ImageDimension << " blocks\n";
+        tiledRegister(fixed, moving, model, layout, tiled);
+        fixed.release();
+        return transform;
+    }
+
+    // B-spline registration after `affine` within ceilingBytes: bsplineRegisterTransform on
+    // reduced copies (at least by 2), then `tiled` full-resolution iterations of the final
+    // mesh. The refinement uses Mean Squares where the warm start used Mattes MI, so it is for
+    // images of the same modality; with tiled.iterations == 0 the Mattes result is kept.
+    // Returns the composite (B-spline first, then affine) or nullptr.
+    template <typename TImage, unsigned int SplineOrder = 3>
+    typename itk::CompositeTransform<double, TImage::ImageDimension>::Pointer
+    tiledBSplineRegister(TiledVolume<TImage>& fixed, const TiledVolume<TImage>& moving,
+                         std::size_t ceilingBytes,
+                         const std::array<unsigned int, TImage::ImageDimension>& meshSize,
+                         const BSplineParameters& params,
+                         itk::AffineTransform<double, TImage::ImageDimension>* affine,
+                         const TiledParameters& tiled = {})
+    {
+        constexpr unsigned int Dim = TImage::ImageDimension;
+        using BSplineType = itk::BSplineTransform<double, Dim, SplineOrder>;
+
+        const unsigned int shrink = std::max(
+            2u, workingShrinkForCeiling(fixed.information(), moving.information(), ceilingBytes,
+                                        params.numberOfLevels, false));
+        std::cout << "🧮 B-spline warm start at shrink " << shrink << "\n";
+        typename itk::CompositeTransform<double, Dim>::Pointer composite;
+        {
+            auto fixedWorking  = readShrunk(fixed, shrink, ceilingBytes / 8);
+            auto movingWorking = readShrunk(moving, shrink, ceilingBytes / 8);
+            composite = bsplineRegisterTransform<TImage, SplineOrder>(
+                fixedWorking, movingWorking, meshSize, params, affine);
+        }
+        if (!composite)
+            return nullptr;
+        if (tiled.iterations == 0)
+            return composite;
+        std::cout << "⚠️ The full-resolution refinement switches from Mattes MI to Mean "
+                     "Squares: images of different modalities are pulled away from their "
+                     "alignment. Use --tiled-iterations 0 to keep the Mattes result\n";
+
+        auto* bspline = dynamic_cast<BSplineType*>(
+            composite->GetNthTransform(composite->GetNumberOfTransforms() - 1).GetPointer());
+        const TiledBSplineModel<Dim, SplineOrder> model(bspline, affine);
+        std::cout << "🧩 Full-resolution B-spline refinement\n";
+        const auto layout =
+            residentFixedLayout(fixed, ceilingBytes, bspline->GetNumberOfParameters());
+        std::cout << "   " << layout.edge << "^" << Dim << " blocks\n";
+        tiledRegister(fixed, moving, model, layout, tiled);
+        fixed.release();
+        return composite;
+    }
+
+} // namespace itkexp
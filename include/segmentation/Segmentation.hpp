@@ -6,10 +6,15 @@
 
 namespace itkexp {
 
+template <unsigned int Dim>
+using MaskImageType = itk::Image<unsigned char, Dim>;
+
+// Otsu threshold of an image of any scalar pixel type (no float copy is needed); the mask is
+// 1 above the threshold, 0 elsewhere.
 template <typename TImage>
-typename TImage::Pointer otsuThreshold(const typename TImage::Pointer& input)
+typename MaskImageType<TImage::ImageDimension>::Pointer otsuThreshold(const TImage* input)
 {
-    using FilterType = itk::OtsuThresholdImageFilter<TImage, TImage>;
+    using FilterType = itk::OtsuThresholdImageFilter<TImage, MaskImageType<TImage::ImageDimension>>;
     auto filter = FilterType::New();
     filter->SetInput(input);
     filter->SetInsideValue(0);
@@ -5,7 +5,9 @@
 #include "itkCastImageFilter.h"
 #include "itkImageFileWriter.h"
 #include "itkStatisticsImageFilter.h"
+#include "io/ImageIO.hpp"
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 namespace itkexp
@@ -24,14 +26,12 @@ void exportVolume(const typename TImage::Pointer& image, const std::string& file
     std::cout << "✅ Wrote 3D image: " << filename << std::endl;
 }
 
-// Extract middle slice and save as .png (convert float → uchar)
+// Extract one slice of a 3D image (or of a slab holding it) and save it as .png, rescaled to
+// 0..255 (float → uchar)
 template <typename TImage3D>
-void exportOrthogonalSlicesToPNG(const typename TImage3D::Pointer& image,
-                                 const std::string& outputPrefix)
+void writeSliceToPNG(const typename TImage3D::Pointer& image, unsigned int axis, size_t index,
+                     const std::string& name)
 {
-    constexpr unsigned int Dimension = TImage3D::ImageDimension;
-    static_assert(Dimension == 3, "exportOrthogonalSlicesToPNG expects a 3D image.");
-
     using InputPixelType = typename TImage3D::PixelType;
     using SliceType = itk::Image<InputPixelType, 2>;
     using ExtractType = itk::ExtractImageFilter<TImage3D, SliceType>;
@@ -41,54 +41,85 @@ void exportOrthogonalSlicesToPNG(const typename TImage3D::Pointer& image,
     using WriterType = itk::ImageFileWriter<OutputSliceType>;
 
     const auto region = image->GetLargestPossibleRegion();
-    const auto size = region.GetSize();
+    itk::Index<3> start = region.GetIndex();
+    itk::Size<3> sliceSize = region.GetSize();
 
-    // A helper lambda to extract and write one slice
-    auto writeSlice = [&](unsigned int axis, size_t index, const std::string& name)
-    {
-        itk::Index<3> start = {0, 0, 0};
-        itk::Size<3> sliceSize = size;
-
-        start[axis] = static_cast<long>(index);
-        sliceSize[axis] = 0;
-        itk::ImageRegion<3> sliceRegion(start, sliceSize);
-
-        auto extractor = ExtractType::New();
-        extractor->SetInput(image);
-        extractor->SetExtractionRegion(sliceRegion);
-        extractor->SetDirectionCollapseToSubmatrix();
-        extractor->Update();
-
-        auto rescaler = RescaleType::New();
-        rescaler->SetInput(extractor->GetOutput());
-        rescaler->SetOutputMinimum(0);
-        rescaler->SetOutputMaximum(255);
-        rescaler->Update();
-
-        auto caster = CastType::New();
-        caster->SetInput(rescaler->GetOutput());
-        caster->Update();
-
-        auto writer = WriterType::New();
-        writer->SetFileName(name);
-        writer->SetInput(caster->GetOutput());
-        writer->Update();
-
-        std::cout << "✅ Wrote " << name << " (axis " << axis
-                  << ", index " << index << ")\n";
-    };
+    start[axis] = static_cast<long>(index);
+    sliceSize[axis] = 0;
+    itk::ImageRegion<3> sliceRegion(start, sliceSize);
+
+    auto extractor = ExtractType::New();
+    extractor->SetInput(image);
+    extractor->SetExtractionRegion(sliceRegion);
+    extractor->SetDirectionCollapseToSubmatrix();
+    extractor->Update();
+
+    auto rescaler = RescaleType::New();
+    rescaler->SetInput(extractor->GetOutput());
+    rescaler->SetOutputMinimum(0);
+    rescaler->SetOutputMaximum(255);
+    rescaler->Update();
+
+    auto caster = CastType::New();
+    caster->SetInput(rescaler->GetOutput());
+    caster->Update();
+
+    auto writer = WriterType::New();
+    writer->SetFileName(name);
+    writer->SetInput(caster->GetOutput());
+    writer->Update();
+
+    std::cout << "✅ Wrote " << name << " (axis " << axis
+              << ", index " << index << ")\n";
+}
+
+// Extract middle slice and save as .png (convert float → uchar)
+template <typename TImage3D>
+void exportOrthogonalSlicesToPNG(const typename TImage3D::Pointer& image,
+                                 const std::string& outputPrefix)
+{
+    constexpr unsigned int Dimension = TImage3D::ImageDimension;
+    static_assert(Dimension == 3, "exportOrthogonalSlicesToPNG expects a 3D image.");
+
+    const auto size = image->GetLargestPossibleRegion().GetSize();
 
     // Pick roughly the middle of each dimension
     const size_t xMid = size[0] / 2;
     const size_t yMid = size[1] / 2;
     const size_t zMid = size[2] / 2;
 
-    writeSlice(2, zMid, outputPrefix + "_axial.png");      // Z-slice
-    writeSlice(1, yMid, outputPrefix + "_coronal.png");    // Y-slice
-    writeSlice(0, xMid, outputPrefix + "_sagittal.png");   // X-slice
+    writeSliceToPNG<TImage3D>(image, 2, zMid, outputPrefix + "_axial.png");      // Z-slice
+    writeSliceToPNG<TImage3D>(image, 1, yMid, outputPrefix + "_coronal.png");    // Y-slice
+    writeSliceToPNG<TImage3D>(image, 0, xMid, outputPrefix + "_sagittal.png");   // X-slice
 }
 
+// Same, straight from a file: only a one-voxel slab around each middle slice is read
+// (streamed where the format allows, see ImageIO::readRegion)
+template <typename TImage3D>
+void exportOrthogonalSlicesToPNG(const std::string& filename, const std::string& outputPrefix)
+{
+    static_assert(TImage3D::ImageDimension == 3, "exportOrthogonalSlicesToPNG expects a 3D image.");
+    using IO = ImageIO<typename TImage3D::PixelType, 3>;
 
+    const auto info = readImageInformation(filename);
+    if (info.dimension != 3)
+        throw std::runtime_error(filename + " is not a 3D image");
 
+    auto writeMiddle = [&](unsigned int axis, const std::string& name)
+    {
+        typename TImage3D::IndexType start{};
+        typename TImage3D::SizeType slab;
+        for (unsigned int d = 0; d < 3; ++d)
+            slab[d] = info.size[d];
+        start[axis] = static_cast<long>(info.size[axis] / 2);
+        slab[axis] = 1;
+        auto image = IO::readRegion(filename, typename TImage3D::RegionType(start, slab));
+        writeSliceToPNG<TImage3D>(image, axis, info.size[axis] / 2, name);
+    };
+
+    writeMiddle(2, outputPrefix + "_axial.png");      // Z-slice
+    writeMiddle(1, outputPrefix + "_coronal.png");    // Y-slice
+    writeMiddle(0, outputPrefix + "_sagittal.png");   // X-slice
+}
 
 } // namespace itkexp
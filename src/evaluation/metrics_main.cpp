@@ -1,22 +1,33 @@
+#include "evaluation/JacobianQA.hpp"
 #include "evaluation/Metrics.hpp"
+#include "io/ImageIO.hpp"
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
-#include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 
 // Usage:
 //   itk_metrics fixed moving registered [fixed_labels registered_labels] [--csv output/metrics.csv]
+//               [--field field.nrrd | --transform deformable.tfm] [--jacobian jacobian.nrrd]
+//               [--float]
 // Computes MSE/NCC before (fixed vs moving) and after (fixed vs registered).
 // If label images are provided, computes Dice as well.
+// With a displacement field or transform, the Jacobian determinant on the fixed grid is
+// summarized (min/percentiles/max, % folded voxels) and optionally written as an image.
+// Intensities are read in their on-disk pixel type; --float converts them to float on read.
 
 int main(int argc, char* argv[])
 {
     if (argc < 4) {
         std::cerr
             << "Usage: " << argv[0]
-            << " fixed moving registered [fixed_labels registered_labels] [--csv metrics.csv]\n";
+            << " fixed moving registered [fixed_labels registered_labels] [--csv metrics.csv]\n"
+            << "  [--field field.nrrd | --transform deformable.tfm] [--jacobian jacobian.nrrd]\n"
+            << "  [--float]   read intensities as float instead of their stored type\n";
         return EXIT_FAILURE;
     }
 
@@ -25,12 +36,30 @@ int main(int argc, char* argv[])
     std::string regPath    = argv[3];
 
     std::string fixedLabPath, regLabPath, csvPath = "output/metrics.csv";
+    std::string fieldPath, transformPath, jacobianPath;
+    bool        asFloat = false;
     for (int i = 4; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "--csv" && i + 1 < argc) {
             csvPath = argv[++i];
             continue;
         }
+        if (a == "--field" && i + 1 < argc) {
+            fieldPath = argv[++i];
+            continue;
+        }
+        if (a == "--transform" && i + 1 < argc) {
+            transformPath = argv[++i];
+            continue;
+        }
+        if (a == "--jacobian" && i + 1 < argc) {
+            jacobianPath = argv[++i];
+            continue;
+        }
+        if (a == "--float") {
+            asFloat = true;
+            continue;
+        }
         if (fixedLabPath.empty()) {
             fixedLabPath = a;
             continue;
@@ -42,39 +71,104 @@ int main(int argc, char* argv[])
     }
 
     constexpr unsigned int Dim = 3;
-    using Pixel                = float;
-    using Image                = itk::Image<Pixel, Dim>;
     using LabelPixel           = unsigned short;
     using LabelImage           = itk::Image<LabelPixel, Dim>;
 
     try {
-        auto read = [](const std::string& p) {
-            using Reader = itk::ImageFileReader<Image>;
-            auto r       = Reader::New();
-            r->SetFileName(p);
-            r->Update();
-            return r->GetOutput();
+        // Rows are appended to the CSV, under a header written when the file is new. An existing
+        // file must have the current columns (rows under an older header would be misread);
+        // this is checked before any work is done.
+        const std::string header =
+            "fixed,moving,registered,mse_before,ncc_before,mse_after,ncc_after,dice,"
+            "jac_min,jac_p01,jac_p50,jac_p99,jac_max,folding_pct";
+        bool writeHeader = true;
+        {
+            std::ifstream fin(csvPath);
+            std::string   existing;
+            if (fin.good() && std::getline(fin, existing)) {
+                if (existing != header)
+                    throw std::runtime_error(csvPath +
+                                             " has other columns than this version writes; "
+                                             "move it aside or pass another --csv");
+                writeHeader = false;
+            }
+        }
+
+        // Sizes are checked from the headers, so mismatched inputs fail before any voxel is read
+        auto fixedInfo = itkexp::readImageInformation(fixedPath);
+        auto checkSize = [&](const std::string& p) {
+            auto info = itkexp::readImageInformation(p);
+            if (info.size != fixedInfo.size)
+                throw std::runtime_error(p + " does not have the size of the fixed image " +
+                                         fixedPath);
+            return info;
         };
+        auto movingInfo = checkSize(movingPath);
+        auto regInfo    = checkSize(regPath);
+        if (!fixedLabPath.empty() && !regLabPath.empty()) {
+            checkSize(fixedLabPath);
+            checkSize(regLabPath);
+        }
+        if (asFloat) {
+            fixedInfo.component = movingInfo.component = regInfo.component =
+                itk::IOComponentEnum::FLOAT;
+        }
+
+        // Images are compared in the pixel types stored on disk (--float converts on read as
+        // before). Reads go through the shared image cache: an input given twice (e.g. moving
+        // as the registered image of an identity run) is decoded once.
+        double mse_before = 0.0, ncc_before = 0.0, mse_after = 0.0, ncc_after = 0.0;
+        bool                  hasJacobian = false;
+        itkexp::JacobianStats jac;
+        itkexp::visitComponentType(fixedInfo, [&]<typename TFixed>() {
+            using FixedImage = itk::Image<TFixed, Dim>;
+            auto fixed       = itkexp::ImageIO<TFixed, Dim>::readShared(fixedPath);
+            itkexp::printPixelMemory(fixed.GetPointer(), fixedPath);
 
-        auto fixed  = read(fixedPath);
-        auto moving = read(movingPath);
-        auto reg    = read(regPath);
+            auto compare = [&](const std::string& path, const itkexp::ImageInformation& info,
+                               double& mse, double& ncc) {
+                itkexp::visitComponentType(info, [&]<typename TOther>() {
+                    using OtherImage = itk::Image<TOther, Dim>;
+                    auto other       = itkexp::ImageIO<TOther, Dim>::readShared(path);
+                    itkexp::printPixelMemory(other.GetPointer(), path);
+                    mse = itkexp::computeMSE<FixedImage, OtherImage>(fixed, other);
+                    ncc = itkexp::computeNCC<FixedImage, OtherImage>(fixed, other);
+                });
+            };
+            compare(movingPath, movingInfo, mse_before, ncc_before);
+            compare(regPath, regInfo, mse_after, ncc_after);
 
-        const double mse_before = itkexp::computeMSE<Image>(fixed, moving);
-        const double ncc_before = itkexp::computeNCC<Image>(fixed, moving);
-        const double mse_after  = itkexp::computeMSE<Image>(fixed, reg);
-        const double ncc_after  = itkexp::computeNCC<Image>(fixed, reg);
+            // Jacobian QA of the deformation, on the fixed grid
+            if (!fieldPath.empty() || !transformPath.empty()) {
+                const auto start = std::chrono::steady_clock::now();
+                auto field = !fieldPath.empty()
+                                 ? itkexp::readDisplacementField<Dim>(fieldPath)
+                                 : itkexp::displacementFieldFromTransformFile<FixedImage>(
+                                       transformPath, fixed.GetPointer());
+                auto det    = itkexp::jacobianDeterminant<Dim>(field);
+                jac         = itkexp::jacobianStats<Dim>(det);
+                hasJacobian = true;
+                std::cout << "⏱️ Jacobian QA: "
+                          << std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                                           start)
+                                 .count()
+                          << " s\n";
+
+                if (!jacobianPath.empty()) {
+                    auto writer = itk::ImageFileWriter<itkexp::JacobianImageType<Dim>>::New();
+                    writer->SetFileName(jacobianPath);
+                    writer->SetInput(det);
+                    writer->Update();
+                    std::cout << "💾 Jacobian map written: " << jacobianPath << "\n";
+                }
+            }
+        });
 
         double dice = -1.0;
         if (!fixedLabPath.empty() && !regLabPath.empty()) {
-            using LReader = itk::ImageFileReader<LabelImage>;
-            auto r1       = LReader::New();
-            r1->SetFileName(fixedLabPath);
-            r1->Update();
-            auto r2 = LReader::New();
-            r2->SetFileName(regLabPath);
-            r2->Update();
-            dice = itkexp::computeDice<LabelImage>(r1->GetOutput(), r2->GetOutput());
+            using LabelIO = itkexp::ImageIO<LabelPixel, Dim>;
+            dice = itkexp::computeDice<LabelImage>(LabelIO::readShared(fixedLabPath),
+                                                   LabelIO::readShared(regLabPath));
         }
 
         // Print summary
@@ -85,23 +179,29 @@ int main(int argc, char* argv[])
                   << "NCC   after: " << ncc_after << "\n";
         if (dice >= 0.0)
             std::cout << "Dice (labels): " << dice << "\n";
-
-        // Write CSV header if file doesn't exist
-        bool writeHeader = true;
-        {
-            std::ifstream fin(csvPath);
-            writeHeader = !fin.good();
+        if (hasJacobian) {
+            std::cout << "Jacobian min/p1/p50/p99/max: " << jac.min << " / " << jac.p01 << " / "
+                      << jac.p50 << " / " << jac.p99 << " / " << jac.max << "\n"
+                      << "Folding (det <= 0): " << jac.foldingPercent << " %"
+                      << (jac.foldingPercent > 0.0 ? "  ⚠️" : "") << "\n";
         }
+        itkexp::printImageCacheStats(itkexp::ImageCache::instance().stats());
+
         std::ofstream csv(csvPath, std::ios::app);
         if (!csv) {
             std::cerr << "Failed to open CSV for writing: " << csvPath << "\n";
         } else {
-            if (writeHeader) {
-                csv << "fixed,moving,registered,mse_before,ncc_before,mse_after,ncc_after,dice\n";
-            }
+            if (writeHeader)
+                csv << header << "\n";
             csv << fixedPath << "," << movingPath << "," << regPath << "," << mse_before << ","
                 << ncc_before << "," << mse_after << "," << ncc_after << ","
-                << (dice >= 0.0 ? std::to_string(dice) : "") << "\n";
+                << (dice >= 0.0 ? std::to_string(dice) : "");
+            if (hasJacobian) {
+                csv << "," << jac.min << "," << jac.p01 << "," << jac.p50 << "," << jac.p99 << ","
+                    << jac.max << "," << jac.foldingPercent << "\n";
+            } else {
+                csv << ",,,,,,\n";
+            }
             std::cout << "📄 Metrics appended to " << csvPath << "\n";
         }
     } catch (const itk::ExceptionObject& e) {
@@ -1,6 +1,5 @@
 #include "filters/Intensity.hpp"
-#include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
+#include "io/ImageIO.hpp"
 #include <iostream>
 
 int main(int argc, char* argv[])
@@ -21,17 +20,10 @@ int main(int argc, char* argv[])
 
     try
     {
-        auto reader = itk::ImageFileReader<ImageType>::New();
-        reader->SetFileName(inputFile);
-        reader->Update();
-
-        auto input = reader->GetOutput();
+        using IO = itkexp::ImageIO<PixelType, Dimension>;
+        auto input = IO::readImage(inputFile);
         auto normalized = itkexp::rescaleIntensity<ImageType>(input, 0.0, rangeMax);
-
-        auto writer = itk::ImageFileWriter<ImageType>::New();
-        writer->SetFileName(outputFile);
-        writer->SetInput(normalized);
-        writer->Update();
+        IO::writeImage(normalized, outputFile);
 
         std::cout << "✅ Normalized image written to " << outputFile << std::endl;
     }
@@ -40,6 +32,11 @@ int main(int argc, char* argv[])
         std::cerr << "ITK Exception: " << e << std::endl;
         return EXIT_FAILURE;
     }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
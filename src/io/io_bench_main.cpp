@@ -0,0 +1,148 @@
+#include "io/ImageIO.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+
+using namespace itkexp;
+
+// .nii.gz throughput: ITK's single-threaded zlib path against block gzip on several threads,
+// in MB/s of decoded image data (best of --repeat runs). Then .nii.gz, .nrrd and the bricked
+// .ixb format compared for writes, full reads and the read of one axial slice. Last, the input
+// read in its stored pixel type against float.
+
+template <typename Fn>
+static double bestSeconds(unsigned int repeat, Fn&& fn) {
+    double best = std::numeric_limits<double>::max();
+    for (unsigned int r = 0; r < repeat; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(
+            best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: itk_io_bench <image> [--level 0-9] [--threads N] [--repeat N]"
+                     " [--dir DIR]\n";
+        return EXIT_FAILURE;
+    }
+
+    const std::filesystem::path inputPath = argv[1];
+    int level = gzipLevel();
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned int repeat = 3;
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+                                std::format("itkexp-bench-{}", getpid());
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--level" && i + 1 < argc) {
+            level = std::clamp(std::stoi(argv[++i]), 0, 9);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        using ImageType = itk::Image<float, 3>;
+        auto image = ImageIO<float, 3>::readImage(inputPath);
+        const double mb = image->GetLargestPossibleRegion().GetNumberOfPixels() *
+                          sizeof(float) / 1e6;
+        std::filesystem::create_directories(dir);
+        const auto zlibPath = dir / "zlib.nii.gz";
+        const auto blockPath = dir / "block.nii.gz";
+
+        const double zlibWrite =
+            bestSeconds(repeat, [&] { writeImageFile<ImageType>(image, zlibPath, level, 1); });
+        const double blockWrite = bestSeconds(
+            repeat, [&] { writeImageFile<ImageType>(image, blockPath, level, threads); });
+        const double zlibRead =
+            bestSeconds(repeat, [&] { readImageFile<ImageType>(zlibPath, 1); });
+        const double blockZlibRead =
+            bestSeconds(repeat, [&] { readImageFile<ImageType>(blockPath, 1); });
+        const double blockRead =
+            bestSeconds(repeat, [&] { readImageFile<ImageType>(blockPath, threads); });
+
+        auto fileMB = [](const std::filesystem::path& p) {
+            return std::filesystem::file_size(p) / 1e6;
+        };
+        std::cout << std::format("📊 {}: {:.1f} MB decoded, level {}, {} threads, best of {}\n",
+                                 inputPath.filename().string(), mb, level, threads, repeat);
+        std::cout << std::format("{:<28}{:>12}{:>12}{:>10}\n", "path", "write MB/s", "read MB/s",
+                                 "file MB");
+        std::cout << std::format("{:<28}{:>12.1f}{:>12.1f}{:>10.1f}\n", "ITK zlib (1 thread)",
+                                 mb / zlibWrite, mb / zlibRead, fileMB(zlibPath));
+        std::cout << std::format("{:<28}{:>12}{:>12.1f}{:>10}\n", "block gzip, zlib reader", "",
+                                 mb / blockZlibRead, "");
+        std::cout << std::format("{:<28}{:>12.1f}{:>12.1f}{:>10.1f}\n",
+                                 std::format("block gzip ({} threads)", threads), mb / blockWrite,
+                                 mb / blockRead, fileMB(blockPath));
+        std::cout << std::format("Speed-up: write {:.2f}x, read {:.2f}x\n", zlibWrite / blockWrite,
+                                 zlibRead / blockRead);
+
+        // Formats: the middle axial slice as a one-voxel slab, through ImageIO::readRegion
+        using IO = ImageIO<float, 3>;
+        auto slab = image->GetLargestPossibleRegion();
+        slab.SetIndex(2, slab.GetSize(2) / 2);
+        slab.SetSize(2, 1);
+        std::cout << std::format("\n{:<28}{:>12}{:>12}{:>12}{:>10}\n", "format", "write MB/s",
+                                 "read MB/s", "slice ms", "file MB");
+        auto compare = [&](const std::string& label, const std::filesystem::path& path,
+                           auto&& write, auto&& read) {
+            const double writeSeconds = bestSeconds(repeat, write);
+            const double readSeconds = bestSeconds(repeat, read);
+            const double sliceSeconds =
+                bestSeconds(repeat, [&] { (void)IO::readRegion(path, slab); });
+            std::cout << std::format("{:<28}{:>12.1f}{:>12.1f}{:>12.2f}{:>10.1f}\n", label,
+                                     mb / writeSeconds, mb / readSeconds, 1e3 * sliceSeconds,
+                                     fileMB(path));
+        };
+        compare("nii.gz (ITK zlib)", zlibPath,
+                [&] { writeImageFile<ImageType>(image, zlibPath, level, 1); },
+                [&] { readImageFile<ImageType>(zlibPath, 1); });
+        const auto nrrdPath = dir / "volume.nrrd";
+        compare("nrrd (raw)", nrrdPath, [&] { writeImageFile<ImageType>(image, nrrdPath); },
+                [&] { readImageFile<ImageType>(nrrdPath); });
+        const auto brickPath = dir / "volume.ixb";
+        compare(std::format("ixb ({}^3 bricks)", BrickEdge), brickPath,
+                [&] { writeBricked<ImageType>(image, brickPath, level, threads); },
+                [&] { readBricked<ImageType>(brickPath, nullptr, threads); });
+        std::filesystem::remove_all(dir);
+
+        // The input read in its stored pixel type against the float conversion every tool used
+        // to do: read time and pixel memory held
+        std::cout << std::format("\n{:<28}{:>12}{:>12}\n", "read as", "read ms", "pixel MB");
+        auto readAs = [&](const std::string& label, auto pixel) {
+            using IO = ImageIO<decltype(pixel), 3>;
+            typename IO::ImagePointer held;
+            const double seconds = bestSeconds(repeat, [&] { held = IO::readImage(inputPath); });
+            std::cout << std::format("{:<28}{:>12.1f}{:>12.1f}\n", label, 1e3 * seconds,
+                                     held->GetPixelContainer()->Size() * sizeof(pixel) / 1e6);
+        };
+        const auto info = readImageInformation(inputPath);
+        image = nullptr;
+        visitComponentType(info, [&]<typename TPixel>() {
+            readAs(std::format("native ({})", itk::ImageIOBase::GetComponentTypeAsString(
+                                                  itk::ImageIOBase::MapPixelType<TPixel>::CType)),
+                   TPixel{});
+        });
+        readAs("float", float{});
+    } catch (const std::exception& e) {
+        std::cerr << "❌ " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,12 +1,58 @@
 #include "io/ImageIO.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <filesystem>
+#include <vector>
 
 using namespace itkexp;
 
+// Header summary of one image, or of every image in a directory, without reading voxels.
+static int printInfo(const std::filesystem::path& target) {
+    std::vector<std::filesystem::path> files;
+    if (std::filesystem::is_directory(target)) {
+        for (const auto& entry : std::filesystem::directory_iterator(target)) {
+            const auto ext = entry.path().extension().string();
+            if (entry.is_regular_file() &&
+                (ext == ".nii" || ext == ".gz" || ext == ".nrrd" || ext == ".mha" ||
+                 ext == ".mhd" || ext == ".ixb"))
+                files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+    } else {
+        files.push_back(target);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::size_t failed = 0;
+    double diskMB = 0.0, decodedMB = 0.0;
+    for (const auto& file : files) {
+        try {
+            const auto info = readImageInformation(file);
+            printImageInformation(info);
+            diskMB += info.fileBytes / 1e6;
+            decodedMB += info.pixelBytes() / 1e6;
+        } catch (const std::exception& e) {
+            std::cerr << "❌ " << e.what() << "\n";
+            ++failed;
+        }
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::format("⏱️ {} headers in {:.3f} s ({:.1f} MB on disk, {:.1f} MB decoded"
+                             "{})\n",
+                             files.size(), seconds, diskMB, decodedMB,
+                             failed ? std::format(", {} unreadable", failed) : "");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv) {
+    if (argc == 3 && std::string(argv[1]) == "--info") {
+        return printInfo(argv[2]);
+    }
     if (argc < 3) {
-        std::cerr << "Usage: itk_io <input_image> <output_image>\n";
+        std::cerr << "Usage: itk_io <input_image> <output_image>\n"
+                     "       itk_io --info <image|directory>\n";
         return EXIT_FAILURE;
     }
 
@@ -1,11 +1,12 @@
 #include <iomanip>
 #include <iostream>
 
-#include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkNormalVariateGenerator.h"
 #include "itkTransformFileWriter.h"
+#include "io/ImageIO.hpp"
 #include "registration/MultiModalRegistration.h"
+#include "registration/MultiResolution.hpp"
 
 namespace Registration {
 
@@ -44,32 +45,26 @@ namespace Registration {
     bool MultiModalRegistration::LoadImages(const std::string& fixedPath,
                                             const std::string& movingPath)
     {
-        using ReaderType = itk::ImageFileReader<ImageType>;
+        using IO = itkexp::ImageIO<PixelType, Dimension>;
 
         try {
             // Load fixed image
-            auto fixedReader = ReaderType::New();
-            fixedReader->SetFileName(fixedPath);
-            fixedReader->Update();
-            fixedImage_ = fixedReader->GetOutput();
+            fixedImage_ = IO::readImage(fixedPath);
 
             std::cout << "Loaded fixed image: " << fixedPath << std::endl;
             std::cout << "  Size: " << fixedImage_->GetLargestPossibleRegion().GetSize()
                       << std::endl;
 
             // Load moving image
-            auto movingReader = ReaderType::New();
-            movingReader->SetFileName(movingPath);
-            movingReader->Update();
-            movingImage_ = movingReader->GetOutput();
+            movingImage_ = IO::readImage(movingPath);
 
             std::cout << "Loaded moving image: " << movingPath << std::endl;
             std::cout << "  Size: " << movingImage_->GetLargestPossibleRegion().GetSize()
                       << std::endl;
 
             return true;
-        } catch (const itk::ExceptionObject& e) {
-            std::cerr << "Error loading images: " << e << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Error loading images: " << e.what() << std::endl;
             return false;
         }
     }
@@ -166,32 +161,26 @@ namespace Registration {
             auto initialTransform = InitializeTransform();
             registration->SetInitialTransform(initialTransform);
 
-            // Multi-resolution pyramid
-            typename RegistrationType::ShrinkFactorsArrayType shrinkFactors;
-            shrinkFactors.SetSize(params_.pyramidLevels);
-
-            typename RegistrationType::SmoothingSigmasArrayType smoothingSigmas;
-            smoothingSigmas.SetSize(params_.pyramidLevels);
-
-            // Setup pyramid schedule
-            for (unsigned int level = 0; level < params_.pyramidLevels; ++level) {
-                shrinkFactors[level] =
-                    1 << (params_.pyramidLevels - 1 - level);  // 8, 4, 2, 1 for 4 levels
-                smoothingSigmas[level] = params_.pyramidLevels - 1 - level;  // 3, 2, 1, 0
-            }
+            // Multi-resolution pyramid: nominal shrink 8, 4, 2, 1 and sigmas 3, 2, 1, 0 for
+            // 4 levels, per axis when the spacing is anisotropic
+            itkexp::configurePyramid(registration.GetPointer(), fixedImage_.GetPointer(),
+                                     params_.pyramidLevels, params_.anisotropicShrink);
 
-            registration->SetNumberOfLevels(params_.pyramidLevels);
-            registration->SetShrinkFactorsPerLevel(shrinkFactors);
-            registration->SetSmoothingSigmasPerLevel(smoothingSigmas);
-            registration->SetSmoothingSigmasAreSpecifiedInPhysicalUnits(true);
+            auto levelTimer = itkexp::LevelTimer::New();
+            levelTimer->SetOptimizer(optimizer);
+            registration->AddObserver(itk::MultiResolutionIterationEvent(), levelTimer);
 
-            std::cout << "Pyramid levels: " << params_.pyramidLevels << std::endl;
+            std::cout << "Pyramid levels: " << params_.pyramidLevels
+                      << (params_.anisotropicShrink ? " (per-axis shrink)" : " (uniform shrink)")
+                      << std::endl;
+            itkexp::printPyramidSchedule(registration.GetPointer(), fixedImage_.GetPointer());
             std::cout << "Max iterations: " << params_.maxIterations << std::endl;
             std::cout << "Learning rate: " << params_.learningRate << std::endl;
             std::cout << "Relaxation factor: " << params_.relaxationFactor << std::endl;
 
             // Perform registration
             registration->Update();
+            levelTimer->Stop();
 
             // Get results
             result.transform = dynamic_cast<TransformType*>(registration->GetModifiableTransform());
@@ -270,28 +259,23 @@ namespace Registration {
             registration->SetInitialTransform(initialTransform);
 
             // Multi-resolution pyramid
-            typename RegistrationType::ShrinkFactorsArrayType shrinkFactors;
-            shrinkFactors.SetSize(params_.pyramidLevels);
-
-            typename RegistrationType::SmoothingSigmasArrayType smoothingSigmas;
-            smoothingSigmas.SetSize(params_.pyramidLevels);
+            itkexp::configurePyramid(registration.GetPointer(), fixedImage_.GetPointer(),
+                                     params_.pyramidLevels, params_.anisotropicShrink);
 
-            for (unsigned int level = 0; level < params_.pyramidLevels; ++level) {
-                shrinkFactors[level]   = 1 << (params_.pyramidLevels - 1 - level);
-                smoothingSigmas[level] = params_.pyramidLevels - 1 - level;
-            }
+            auto levelTimer = itkexp::LevelTimer::New();
+            levelTimer->SetOptimizer(optimizer);
+            registration->AddObserver(itk::MultiResolutionIterationEvent(), levelTimer);
 
-            registration->SetNumberOfLevels(params_.pyramidLevels);
-            registration->SetShrinkFactorsPerLevel(shrinkFactors);
-            registration->SetSmoothingSigmasPerLevel(smoothingSigmas);
-            registration->SetSmoothingSigmasAreSpecifiedInPhysicalUnits(true);
-
-            std::cout << "Pyramid levels: " << params_.pyramidLevels << std::endl;
+            std::cout << "Pyramid levels: " << params_.pyramidLevels
+                      << (params_.anisotropicShrink ? " (per-axis shrink)" : " (uniform shrink)")
+                      << std::endl;
+            itkexp::printPyramidSchedule(registration.GetPointer(), fixedImage_.GetPointer());
             std::cout << "Max iterations: " << params_.maxIterations << std::endl;
             std::cout << "Initial radius: " << params_.initialRadius << std::endl;
 
             // Perform registration
             registration->Update();
+            levelTimer->Stop();
 
             // Get results
             result.transform = dynamic_cast<TransformType*>(registration->GetModifiableTransform());
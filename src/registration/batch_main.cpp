@@ -1,17 +1,86 @@
 #include "registration/Registration.hpp"      // affine
 #include "registration/BSplineRegistration.hpp" // optional deformable
-#include "itkImageFileReader.h"
+#include "registration/DemonsRegistration.hpp"  // optional deformable
+#include "evaluation/Metrics.hpp"
+#include "batch/Admission.hpp"
+#include "batch/JobScheduler.hpp"
+#include "batch/Manifest.hpp"
+#include "batch/Prefetcher.hpp"
+#include "batch/RunReport.hpp"
+#include "batch/Sharding.hpp"
+#include "io/AsyncWriter.hpp"
+#include "io/ImageIO.hpp"
+#include "itkImageDuplicator.h"
+#include "itkImageFileWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+// One engine's result on one subject, for the comparison table
+struct EngineResult
+{
+    std::string subject;
+    std::string engine;
+    double affineSeconds = 0.0;
+    double seconds = 0.0;
+    double mse = 0.0;
+    double ncc = 0.0;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Fn>
+double timeSeconds(Fn&& fn)
+{
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    return secondsSince(start);
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 4) {
         std::cerr << "Usage: " << argv[0]
-                  << " fixedImage inputDir outputDir [--bspline 4,4,4]\n";
+                  << " fixedImage inputDir outputDir [--bspline 4,4,4] [--bspline-levels N]\n"
+                     "  [--bspline-optimizer rsgd|lbfgsb|sgd] [--lbfgsb-bound MM]"
+                     " [--lbfgsb-memory N]\n"
+                     "  [--sgd-samples N] [--sgd-decay A,ALPHA]  sgd: random points per iteration"
+                     " (default: 3000), step decay (default: 20,0.602)\n"
+                     "  [--demons] [--demons-levels N] [--demons-iterations N]"
+                     " [--demons-sigma VOX]\n"
+                     "  [--affine-levels N] [--affine-iterations 200,100,50]"
+                     " [--affine-single-level]\n"
+                     "  [--jobs N] [--threads-per-job N]  concurrent subjects / ITK threads each"
+                     " (default: auto)\n"
+                     "  [--prefetch K] [--io-mem MB]  read-ahead depth (default: jobs, 0 = off)"
+                     " and read-ahead/write-behind memory (default: 2048)\n"
+                     "  [--mem-budget MB]  admit jobs while their estimated memory fits MB"
+                     " (default: 0 = no limit)\n"
+                     "  [--force]  rerun subjects the manifest in outputDir marks up to date\n"
+                     "  [--shard i/N]  process only shard i of N (static split across workers)\n"
+                     "  [--dynamic] [--stale-timeout S]  claim subjects through lock files in"
+                     " outputDir (default timeout: 600)\n"
+                     "  [--worker-id NAME]  name of this worker (default: hostname-pid)\n"
+                     "  --bspline and --demons together run both and print a comparison\n";
         return EXIT_FAILURE;
     }
 
@@ -20,11 +89,81 @@ int main(int argc, char* argv[])
     fs::path outputDir = argv[3];
     bool useBSpline = false;
     std::array<unsigned int,3> mesh{4,4,4};
+    itkexp::BSplineParameters bsplineParams;
+    bool useDemons = false;
+    itkexp::DemonsParameters demonsParams;
+    itkexp::AffineParameters affineParams;
+    unsigned int jobs = 0;
+    unsigned int threadsPerJob = 0;
+    int prefetch = -1; // -1: one image per concurrent job
+    std::size_t ioMemMB = 2048;
+    std::size_t memBudgetMB = 0;
+    bool force = false;
+    std::optional<itkexp::Shard> shard;
+    bool dynamic = false;
+    double staleSeconds = 600;
+    std::string workerId;
 
-    if (argc >= 6 && std::string(argv[4]) == "--bspline") {
-        useBSpline = true;
-        if (sscanf(argv[5], "%u,%u,%u", &mesh[0], &mesh[1], &mesh[2]) != 3) {
-            std::cerr << "Invalid mesh string. Use e.g. 4,4,4\n";
+    for (int i = 4; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--bspline" && i + 1 < argc) {
+            useBSpline = true;
+            if (sscanf(argv[++i], "%u,%u,%u", &mesh[0], &mesh[1], &mesh[2]) != 3) {
+                std::cerr << "Invalid mesh string. Use e.g. 4,4,4\n";
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--bspline-levels" && i + 1 < argc) {
+            bsplineParams.numberOfLevels = std::stoi(argv[++i]);
+        } else if (arg == "--bspline-optimizer" && i + 1 < argc) {
+            bsplineParams.optimizer = itkexp::parseBSplineOptimizer(argv[++i]);
+        } else if (arg == "--lbfgsb-bound" && i + 1 < argc) {
+            bsplineParams.lbfgsbBound = std::stod(argv[++i]);
+        } else if (arg == "--lbfgsb-memory" && i + 1 < argc) {
+            bsplineParams.lbfgsbMemory = std::stoi(argv[++i]);
+        } else if (arg == "--sgd-samples" && i + 1 < argc) {
+            bsplineParams.stochasticSamples = std::stoi(argv[++i]);
+        } else if (arg == "--sgd-decay" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%lf,%lf", &bsplineParams.stochasticOffset,
+                       &bsplineParams.stochasticAlpha) != 2) {
+                std::cerr << "Invalid decay. Use e.g. 20,0.602\n";
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--affine-levels" && i + 1 < argc) {
+            affineParams.numberOfLevels = std::stoi(argv[++i]);
+        } else if (arg == "--affine-iterations" && i + 1 < argc) {
+            affineParams.iterations = itkexp::parseIterationSchedule(argv[++i]);
+        } else if (arg == "--affine-single-level") {
+            affineParams = itkexp::singleLevelAffineParameters();
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = std::stoi(argv[++i]);
+        } else if (arg == "--threads-per-job" && i + 1 < argc) {
+            threadsPerJob = std::stoi(argv[++i]);
+        } else if (arg == "--prefetch" && i + 1 < argc) {
+            prefetch = std::stoi(argv[++i]);
+        } else if (arg == "--io-mem" && i + 1 < argc) {
+            ioMemMB = std::stoul(argv[++i]);
+        } else if (arg == "--mem-budget" && i + 1 < argc) {
+            memBudgetMB = std::stoul(argv[++i]);
+        } else if (arg == "--force") {
+            force = true;
+        } else if (arg == "--shard" && i + 1 < argc) {
+            shard = itkexp::parseShard(argv[++i]);
+        } else if (arg == "--dynamic") {
+            dynamic = true;
+        } else if (arg == "--stale-timeout" && i + 1 < argc) {
+            staleSeconds = std::stod(argv[++i]);
+        } else if (arg == "--worker-id" && i + 1 < argc) {
+            workerId = argv[++i];
+        } else if (arg == "--demons") {
+            useDemons = true;
+        } else if (arg == "--demons-levels" && i + 1 < argc) {
+            demonsParams.numberOfLevels = std::stoi(argv[++i]);
+        } else if (arg == "--demons-iterations" && i + 1 < argc) {
+            demonsParams.iterations = std::stoi(argv[++i]);
+        } else if (arg == "--demons-sigma" && i + 1 < argc) {
+            demonsParams.fieldSigma = std::stod(argv[++i]);
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
             return EXIT_FAILURE;
         }
     }
@@ -37,52 +176,482 @@ int main(int argc, char* argv[])
 
     using ImageType = itk::Image<float,3>;
 
-    // Load fixed once
-    auto fixedReader = itk::ImageFileReader<ImageType>::New();
-    fixedReader->SetFileName(fixedFile);
-    fixedReader->Update();
-    auto fixed = fixedReader->GetOutput();
+    // Load fixed once, through the shared image cache. Jobs register against private copies: a
+    // shared input would have its pipeline state (requested region) updated by several threads
+    // at once.
+    ImageType::ConstPointer fixed = itkexp::ImageIO<float, 3>::readShared(fixedFile);
 
     std::vector<fs::path> files;
     for (auto& p : fs::directory_iterator(inputDir)) {
         if (!p.is_regular_file()) continue;
         const auto ext = p.path().extension().string();
-        if (ext == ".nii" || ext == ".gz" || ext == ".nrrd" || ext == ".mha" || ext == ".mhd")
+        if ((ext == ".nii" || ext == ".gz" || ext == ".nrrd" || ext == ".mha" || ext == ".mhd") &&
+            !fs::equivalent(fixedFile, p.path()))
             files.push_back(p.path());
     }
     if (files.empty()) {
         std::cerr << "No images found in " << inputDir << "\n";
         return EXIT_FAILURE;
     }
+    std::sort(files.begin(), files.end());
+
+    // Several workers (processes or nodes) may share outputDir: statically by --shard, or
+    // dynamically by claiming subjects through lock files
+    const bool distributed = shard || dynamic;
+    if (workerId.empty())
+        workerId = itkexp::defaultWorkerId();
+    if (shard) {
+        std::erase_if(files, [&](const fs::path& f) {
+            return !itkexp::inShard(f.stem().string(), *shard);
+        });
+        std::cout << "Shard " << shard->index << "/" << shard->count << ": " << files.size()
+                  << " subjects\n";
+    }
+
+    // Everything that changes the outputs: engines and their parameters
+    std::ostringstream paramsKey;
+    paramsKey << "affine " << affineParams.numberOfLevels << ' ' << affineParams.anisotropicShrink
+              << affineParams.estimateScales << affineParams.centerInitialize << ' '
+              << affineParams.learningRate << ' ' << affineParams.minimumStepLength << ' '
+              << affineParams.relaxationFactor;
+    for (auto n : affineParams.iterations)
+        paramsKey << ',' << n;
+    if (useBSpline)
+        paramsKey << "\nbspline " << mesh[0] << ',' << mesh[1] << ',' << mesh[2] << ' '
+                  << bsplineParams.numberOfLevels << ' ' << bsplineParams.iterations << ' '
+                  << bsplineParams.anisotropicShrink << ' '
+                  << static_cast<int>(bsplineParams.optimizer) << ' ' << bsplineParams.lbfgsbBound
+                  << ' ' << bsplineParams.lbfgsbMemory << ' ' << bsplineParams.stochasticSamples
+                  << ' ' << bsplineParams.stochasticOffset << ' ' << bsplineParams.stochasticAlpha;
+    if (useDemons)
+        paramsKey << "\ndemons " << demonsParams.numberOfLevels << ' ' << demonsParams.iterations
+                  << ' ' << demonsParams.fieldSigma << ' ' << demonsParams.updateSigma << ' '
+                  << demonsParams.maxStepLength << ' ' << demonsParams.histogramMatch;
+    const std::string paramsHash = itkexp::hashString(paramsKey.str());
+
+    auto outputsFor = [&](const fs::path& f) {
+        std::vector<std::string> outputs;
+        if (useBSpline)
+            outputs.push_back((outputDir / (f.stem().string() + "_bspline.nrrd")).string());
+        if (useDemons)
+            outputs.push_back((outputDir / (f.stem().string() + "_demons.nrrd")).string());
+        if (!useBSpline && !useDemons)
+            outputs.push_back((outputDir / (f.stem().string() + "_reg.nrrd")).string());
+        return outputs;
+    };
+
+    // Skip subjects whose inputs, parameters and tool version match the manifest and whose
+    // outputs still exist
+    itkexp::BatchManifest manifest(outputDir, distributed ? workerId : std::string{});
+    const std::string fixedHash = manifest.fileHash(fixedFile);
+    std::vector<std::string> upToDate;
+    if (!force) {
+        const auto total = files.size();
+        std::erase_if(files, [&](const fs::path& f) {
+            const bool skip =
+                manifest.upToDate(f.stem().string(), fixedHash, f, paramsHash, outputsFor(f));
+            if (skip)
+                upToDate.push_back(f.stem().string());
+            return skip;
+        });
+        if (files.size() < total)
+            std::cout << "⏭️ " << total - files.size()
+                      << " subjects up to date, skipped (--force reruns them)\n";
+    }
 
-    std::cout << "Found " << files.size() << " images. Starting batch...\n";
+    // Validate the remaining inputs from their headers (no voxels are read): unreadable files
+    // and images that are not 3D are reported and skipped. The voxel counts feed the admission
+    // estimates, and the largest subjects start first so a big one does not run alone at the end.
+    std::unordered_map<std::string, double> movingVoxels;
+    std::vector<std::pair<std::string, std::string>> invalid; // subject, reason
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto total = files.size();
+        std::erase_if(files, [&](const fs::path& f) {
+            try {
+                const auto info = itkexp::readImageInformation(f);
+                if (info.dimension != ImageType::ImageDimension) {
+                    std::cerr << "⚠️ Skipping " << f << ": " << info.dimension << "D image\n";
+                    invalid.emplace_back(f.stem().string(), "not 3D");
+                    return true;
+                }
+                movingVoxels[f.string()] = static_cast<double>(info.voxelCount());
+                return false;
+            } catch (const std::exception& e) {
+                std::cerr << "⚠️ Skipping " << f << ": " << e.what() << "\n";
+                invalid.emplace_back(f.stem().string(), "unreadable header");
+                return true;
+            }
+        });
+        std::stable_sort(files.begin(), files.end(), [&](const fs::path& a, const fs::path& b) {
+            return movingVoxels[a.string()] > movingVoxels[b.string()];
+        });
+        std::cout << "🧮 " << total << " headers checked in " << secondsSince(start) << " s\n";
+    }
+    if (files.empty()) {
+        std::cout << "✅ Batch done. Nothing to do in " << outputDir << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    // Dynamic workers start at different points of the list so they rarely race for (and
+    // prefetch) the same subject
+    std::unique_ptr<itkexp::ClaimDirectory> claims;
+    if (dynamic) {
+        std::rotate(files.begin(),
+                    files.begin() + itkexp::fnv1a(workerId.data(), workerId.size()) % files.size(),
+                    files.end());
+        claims = std::make_unique<itkexp::ClaimDirectory>(outputDir / ".claims", workerId,
+                                                          staleSeconds);
+    }
+    auto stampFor = [&](const fs::path& f) {
+        return fixedHash + " " + manifest.fileHash(f) + " " + paramsHash + " " ITKEXP_VERSION;
+    };
+
+    // Per-worker result log, merged into outputDir/results.csv at the end. A single process
+    // appends to one fixed log, so reruns do not add a log per host and pid.
+    fs::create_directories(outputDir / "results");
+    const auto resultLogPath =
+        outputDir / "results" / ((distributed ? workerId : std::string("local")) + ".csv");
+    std::ofstream resultLog(resultLogPath, std::ios::app);
+    if (fs::file_size(resultLogPath) == 0)
+        resultLog << "subject,engine,affine_s,seconds,mse,ncc,worker\n" << std::flush;
+
+    const auto split = itkexp::chooseJobSplit(std::thread::hardware_concurrency(), files.size(),
+                                              jobs, threadsPerJob);
+    itkexp::configureItkThreadsPerJob(split.threadsPerJob);
+    std::cout << "Found " << files.size() << " images. Starting batch with " << split.jobs
+              << " concurrent jobs x " << split.threadsPerJob << " ITK threads...\n";
+
+    // Memory admission: each job's peak is estimated from the moving image header and the
+    // engines, and jobs wait while the admitted estimates would exceed --mem-budget
+    itkexp::JobFootprint footprint;
+    footprint.cachedGradients = affineParams.cacheGradients;
+    footprint.affineLevels    = affineParams.numberOfLevels;
+    footprint.bspline         = useBSpline;
+    footprint.bsplineLevels   = bsplineParams.numberOfLevels;
+    footprint.demons          = useDemons;
+    footprint.demonsLevels    = demonsParams.numberOfLevels;
+    if (useBSpline) {
+        auto finestMesh = mesh;
+        for (auto& cells : finestMesh)
+            cells <<= std::max(1u, bsplineParams.numberOfLevels) - 1;
+        footprint.bsplineParameters =
+            itkexp::bsplineParameterCount<ImageType::ImageDimension, 3>(finestMesh);
+    }
+    const double fixedVoxels = itkexp::voxelCount(fixed.GetPointer());
+    itkexp::ByteSemaphore admission(memBudgetMB * itkexp::MiB);
 
-    for (const auto& f : files) {
+    std::mutex resultsMutex; // guards results, reports, resultLog and finished
+    std::atomic<std::size_t> processed{0};
+    std::vector<EngineResult> results;
+    std::vector<itkexp::SubjectReport> reports; // guarded by resultsMutex
+    auto addReport = [&](itkexp::SubjectReport report) {
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        reports.push_back(std::move(report));
+    };
+    for (const auto& [name, reason] : invalid) {
+        itkexp::SubjectReport report;
+        report.subject = name;
+        report.status = "failed: " + reason;
+        report.worker = workerId;
+        reports.push_back(std::move(report));
+    }
+    for (const auto& name : upToDate) {
+        itkexp::SubjectReport report;
+        report.subject = name;
+        report.status = "up-to-date";
+        report.worker = workerId;
+        reports.push_back(std::move(report));
+    }
+
+    // Inputs are read ahead and outputs written behind on background threads, each within
+    // half of the I/O memory budget, while the CPUs register
+    const std::size_t ioBudget = ioMemMB << 20;
+    const std::size_t prefetchDepth = prefetch < 0 ? split.jobs : prefetch;
+    std::unique_ptr<itkexp::Prefetcher<ImageType>> prefetcher;
+    if (prefetchDepth > 0) {
+        std::vector<std::string> paths;
+        for (const auto& f : files)
+            paths.push_back(f.string());
+        prefetcher = std::make_unique<itkexp::Prefetcher<ImageType>>(
+            paths, prefetchDepth, ioBudget / 2, std::min<unsigned int>(prefetchDepth, 4));
+    }
+    itkexp::AsyncWriter writer(std::max(2u, split.jobs), ioBudget / 2);
+    std::vector<std::future<void>> finished; // per subject: writes reported, manifest updated
+
+    auto processSubject = [&](const fs::path& f) {
+        const auto subjectStart = std::chrono::steady_clock::now();
+        auto report = std::make_shared<itkexp::SubjectReport>();
+        report->subject = f.stem().string();
+        report->worker = workerId;
+        const std::string subject = report->subject;
+        bool claimed = false;
+        bool handedOff = false; // claim and report are finished by the writer task from here on
+        auto fail = [&](const std::string& reason) {
+            report->status = "failed: " + reason;
+            report->totalSeconds = secondsSince(subjectStart);
+            addReport(*report);
+            if (claims && claimed)
+                claims->release(subject);
+        };
         try {
-            // Skip if file is the same as fixed
-            if (fs::equivalent(fixedFile, f)) continue;
+            if (claims && !claims->tryClaim(subject, stampFor(f))) {
+                if (prefetcher)
+                    prefetcher->discard(f.string());
+                itkexp::logLine("⏭️ " + subject + ": done or claimed by another worker");
+                report->status = "claimed-elsewhere";
+                addReport(*report);
+                return;
+            }
+            claimed = true;
+            ++processed;
+
+            const std::size_t estimate = itkexp::estimateJobBytes<ImageType>(
+                fixedVoxels, movingVoxels.at(f.string()), footprint);
+            report->estimateMiB = static_cast<double>(estimate) / itkexp::MiB;
+            const auto admissionStart = std::chrono::steady_clock::now();
+            const auto lease = admission.acquire(estimate);
+            report->admissionSeconds = secondsSince(admissionStart);
 
-            auto movingReader = itk::ImageFileReader<ImageType>::New();
-            movingReader->SetFileName(f.string());
-            movingReader->Update();
-            auto moving = movingReader->GetOutput();
+            auto duplicator = itk::ImageDuplicator<ImageType>::New();
+            duplicator->SetInputImage(fixed);
+            duplicator->Update();
+            ImageType::Pointer jobFixed = duplicator->GetOutput();
 
-            auto outPath = outputDir / (f.stem().string() + "_reg.nrrd");
+            // Outputs of this subject; each future yields the seconds of its write, so nothing
+            // on the writer thread points into this job's state
+            struct Output
+            {
+                fs::path path;
+                std::future<double> done;
+            };
+            auto written = std::make_shared<std::vector<Output>>();
+            auto queueWrite = [&](const ImageType::Pointer& image, const fs::path& path) {
+                written->push_back({path, writer.write(image, path.string())});
+            };
 
-            // Stage 1: Affine
-            auto affined = itkexp::registerImages<ImageType>(fixed, moving, outPath.string());
+            auto record = [&](const std::string& engine, double affineSeconds, double seconds,
+                              const ImageType::Pointer& registered) {
+                EngineResult r{subject, engine, affineSeconds, seconds,
+                               itkexp::computeMSE<ImageType>(jobFixed, registered),
+                               itkexp::computeNCC<ImageType>(jobFixed, registered)};
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                resultLog << r.subject << ',' << r.engine << ',' << r.affineSeconds << ','
+                          << r.seconds << ',' << r.mse << ',' << r.ncc << ',' << workerId << '\n'
+                          << std::flush;
+                results.push_back(std::move(r));
+            };
 
-            // Optional stage 2: B-spline refinement
+            ImageType::Pointer moving;
+            report->readSeconds = timeSeconds([&] {
+                if (prefetcher) {
+                    moving = prefetcher->take(f.string());
+                } else {
+                    moving = itkexp::ImageIO<float, 3>::readImage(f);
+                }
+            });
+
+            // Stage 1: Affine (kept as a transform, no intermediate volume). The resampled
+            // image is only produced when the affine result is the output.
+            const bool affineOnly = !useBSpline && !useDemons;
+            const auto affineOut = outputDir / (subject + "_reg.nrrd");
+            const auto affineStart = std::chrono::steady_clock::now();
+            auto affineResult = itkexp::registerAffine<ImageType>(jobFixed, moving, {}, nullptr,
+                                                                  affineParams, &report->affine);
+            const double affineSeconds = secondsSince(affineStart);
+            report->affineSeconds = affineSeconds;
+            if (!affineResult) {
+                itkexp::logLine("Affine registration failed on " + f.string(), std::cerr);
+                fail("affine");
+                return;
+            }
+            auto affine = affineResult.transform;
+
+            // Stage 2: deformable engines on top of the affine, each interpolating moving once;
+            // engine times exclude the shared affine stage and include the resampling
             if (useBSpline) {
-                auto bsOut = outputDir / (f.stem().string() + "_bspline.nrrd");
-                itkexp::bsplineRegister<ImageType>(fixed, affined, mesh, bsOut.string());
+                auto bsOut = outputDir / (subject + "_bspline.nrrd");
+                ImageType::Pointer registered;
+                const auto stageStart = std::chrono::steady_clock::now();
+                auto transform = itkexp::bsplineRegisterTransform<ImageType>(
+                    jobFixed, moving, mesh, bsplineParams, affine, &report->bspline);
+                report->bsplineSeconds = secondsSince(stageStart);
+                if (transform)
+                    report->resampleSeconds += timeSeconds([&] {
+                        registered = itkexp::resampleToFixed<ImageType>(jobFixed, moving,
+                                                                        transform);
+                    });
+                if (registered) {
+                    queueWrite(registered, bsOut);
+                    record("bspline", affineSeconds, secondsSince(stageStart), registered);
+                } else {
+                    report->status = "failed: bspline";
+                }
             }
+            if (useDemons) {
+                auto demonsOut = outputDir / (subject + "_demons.nrrd");
+                ImageType::Pointer registered;
+                const auto stageStart = std::chrono::steady_clock::now();
+                auto field = itkexp::demonsRegister<ImageType>(jobFixed, moving, demonsParams,
+                                                               affine, &report->demons);
+                report->demonsSeconds = secondsSince(stageStart);
+                if (field)
+                    report->resampleSeconds += timeSeconds(
+                        [&] { registered = itkexp::warpImage<ImageType>(moving, field); });
+                if (registered) {
+                    queueWrite(registered, demonsOut);
+                    record("demons", affineSeconds, secondsSince(stageStart), registered);
+                } else {
+                    report->status = "failed: demons";
+                }
+            }
+            if (affineOnly) {
+                report->resampleSeconds = timeSeconds([&] { affineResult.image(); });
+                queueWrite(affineResult.image(), affineOut);
+                record("affine", affineSeconds, 0.0, affineResult.image());
+            }
+            report->totalSeconds = secondsSince(subjectStart);
 
+            // Once this subject's writes are done (the writer runs tasks in order), report
+            // them and, if every expected output was written, record it in the manifest
+            itkexp::BatchManifest::Entry entry{fixedHash, manifest.fileHash(f), paramsHash};
+            entry.outputs = outputsFor(f);
+            const std::string stamp = claims ? stampFor(f) : std::string{};
+            handedOff = true;
+            auto done = writer.post([&manifest, &claims, &addReport, written, entry, report,
+                                     stamp] {
+                bool complete = written->size() == entry.outputs.size();
+                // Whatever throws below, the claim is settled and the subject reported
+                struct Settle
+                {
+                    std::function<void()> fn;
+                    ~Settle() { fn(); }
+                } settle{[&] {
+                    if (claims && complete)
+                        claims->complete(report->subject, stamp);
+                    else if (claims)
+                        claims->release(report->subject);
+                    addReport(*report);
+                }};
+                auto failed = [&](const std::string& what, const std::string& status) {
+                    itkexp::logLine(what, std::cerr);
+                    report->status = status;
+                    complete = false;
+                };
+                for (auto& output : *written) {
+                    try {
+                        report->writeSeconds += output.done.get();
+                        itkexp::logLine("💾 Written: " + output.path.string());
+                    } catch (const itk::ExceptionObject& e) {
+                        std::ostringstream line;
+                        line << "Failed writing " << output.path << " : " << e;
+                        failed(line.str(), "failed: write");
+                    } catch (const std::exception& e) {
+                        failed("Failed writing " + output.path.string() + " : " + e.what(),
+                               "failed: write");
+                    }
+                }
+                if (complete) {
+                    try {
+                        manifest.record(report->subject, entry);
+                    } catch (const std::exception& e) {
+                        failed("Failed recording " + report->subject + " in the manifest: " +
+                                   e.what(),
+                               "failed: manifest");
+                    }
+                }
+            });
+            {
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                finished.push_back(std::move(done));
+            }
+
+            std::ostringstream line;
+            line << "⏱️ " << f.filename().string() << ": affine " << affineSeconds
+                 << " s, subject total " << report->totalSeconds << " s, memory estimate "
+                 << estimate / itkexp::MiB << " MiB";
+            itkexp::logLine(line.str());
         } catch (const itk::ExceptionObject& e) {
-            std::cerr << "Failed on " << f << " : " << e << "\n";
+            std::ostringstream line;
+            line << "Failed on " << f << " : " << e;
+            itkexp::logLine(line.str(), std::cerr);
+            if (!handedOff)
+                fail(e.GetDescription());
+        } catch (const std::exception& e) {
+            itkexp::logLine("Failed on " + f.string() + " : " + e.what(), std::cerr);
+            if (!handedOff)
+                fail(e.what());
+        }
+    };
+
+    const auto batchStart = std::chrono::steady_clock::now();
+    const double cpuStart = itkexp::processCpuSeconds();
+    {
+        itkexp::JobScheduler scheduler(split.jobs);
+        for (const auto& f : files)
+            scheduler.submit([&processSubject, f] { processSubject(f); });
+        scheduler.wait();
+    }
+
+    // Wait for the background writes and manifest updates
+    for (auto& done : finished) {
+        try {
+            done.get();
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
         }
     }
+    const double batchSeconds = secondsSince(batchStart);
+
+    if (!results.empty()) {
+        std::cout << "\n" << std::left << std::setw(24) << "subject" << std::setw(10) << "engine"
+                  << std::right << std::setw(12) << "affine [s]" << std::setw(10) << "time [s]"
+                  << std::setw(14) << "MSE" << std::setw(10) << "NCC" << "\n";
+        for (const auto& r : results) {
+            std::cout << std::left << std::setw(24) << r.subject << std::setw(10) << r.engine
+                      << std::right << std::fixed << std::setprecision(2) << std::setw(12)
+                      << r.affineSeconds << std::setw(10) << r.seconds << std::setw(14) << r.mse
+                      << std::setprecision(4) << std::setw(10) << r.ncc << "\n";
+        }
+        std::cout.unsetf(std::ios::floatfield);
+    }
+
+    const double cpuSeconds = itkexp::processCpuSeconds() - cpuStart;
+    const std::size_t subjects = processed;
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "🏁 " << subjects << " subjects in " << batchSeconds << " s with "
+              << split.jobs << " jobs x " << split.threadsPerJob << " threads, prefetch "
+              << prefetchDepth << ": "
+              << 3600.0 * subjects / std::max(batchSeconds, 1e-9) << " subjects/hour\n"
+              << "   CPU utilization "
+              << 100.0 * cpuSeconds / (std::max(batchSeconds, 1e-9) * cores) << " % of " << cores
+              << " cores";
+    if (prefetcher) {
+        const auto stats = prefetcher->stats();
+        std::cout << ", inputs: " << stats.hits << " prefetched, " << stats.waits
+                  << " in flight, " << stats.misses << " read inline, " << stats.waitSeconds
+                  << " s waited";
+    }
+    std::cout << "\n";
+    std::cout << "🧮 Memory: admitted job estimates peaked at "
+              << admission.highWater() / itkexp::MiB << " MiB";
+    if (memBudgetMB)
+        std::cout << " of a " << memBudgetMB << " MiB budget";
+    std::cout << ", process peak RSS " << itkexp::peakResidentMiB()
+              << " MiB (all jobs, plus the fixed image and I/O buffers)\n";
+
+    // Machine-readable run report: per subject stage times, iterations, metrics and status
+    const auto reportPath =
+        outputDir / (distributed ? "report." + workerId + ".json" : std::string("report.json"));
+    itkexp::writeRunReport(reportPath, reports, batchSeconds, itkexp::peakResidentMiB(),
+                           ITKEXP_VERSION);
+    std::cout << "📊 Run report: " << reportPath << "\n";
 
+    // Every worker merges what all workers logged so far, one at a time; the last one to
+    // finish leaves the complete table
+    resultLog.close();
+    const auto merged = itkexp::mergeCsvLogs(outputDir / "results", outputDir / "results.csv", 2);
+    std::cout << "📄 " << merged << " results merged into " << outputDir / "results.csv" << "\n";
     std::cout << "✅ Batch done. Outputs in " << outputDir << "\n";
     return EXIT_SUCCESS;
 }
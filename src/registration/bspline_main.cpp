@@ -1,15 +1,46 @@
 #include "registration/BSplineRegistration.hpp"
+#include "evaluation/Metrics.hpp"
+#include "registration/DisplacementField.hpp"
+#include "registration/MemoryBudget.hpp"
 #include "registration/Registration.hpp"
+#include "registration/TiledMetric.hpp"
 #include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkTransformFileWriter.h"
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <array>
+#include <filesystem>
+#include <string>
+#include <vector>
 
 int main(int argc, char* argv[])
 {
     if (argc < 5) {
         std::cerr << "Usage: " << argv[0]
-                  << " fixedImage movingImage outputImage mesh       \n"
-                     "  mesh examples: 4,4,4 or 6,6,6\n";
+                  << " fixedImage movingImage outputImage mesh [options]\n"
+                     "  mesh examples: 4,4,4 or 6,6,6 (coarsest level)\n"
+                     "  --levels N            pyramid levels, mesh doubles per level (default: 1)\n"
+                     "  --iterations N        optimizer iterations per level (default: 200)\n"
+                     "  --optimizer NAME      rsgd (default), lbfgsb or sgd (stochastic)\n"
+                     "  --lbfgsb-bound MM     bound on |coefficient| in mm (default: unbounded)\n"
+                     "  --lbfgsb-memory N     LBFGSB stored corrections (default: 5)\n"
+                     "  --sgd-samples N       sgd: random points per iteration (default: 3000)\n"
+                     "  --sgd-decay A,ALPHA   sgd: step_k = step_0 ((A+1)/(A+k+1))^ALPHA"
+                     " (default: 20,0.602)\n"
+                     "  --compare-optimizers  dense rsgd vs sgd from the same start: time per\n"
+                     "                        iteration, MSE and NCC; writes the sgd result\n"
+                     "  --displacement-field PATH  also write the dense field (.nrrd/.mha)\n"
+                     "  --transform-out PATH  also write the B-spline and affine chain (.tfm),\n"
+                     "                        e.g. for itk_metrics --transform\n"
+                     "  --mem-ceiling MB      stay within MB: reduced warm start, then tiled\n"
+                     "                        full-resolution Mean Squares (same modality only);\n"
+                     "                        no displacement field\n"
+                     "  --tiled-iterations N  full-resolution passes with --mem-ceiling"
+                     " (default: 30, 0 keeps\n"
+                     "                        the Mattes warm start); each pass reads the\n"
+                     "                        moving volume from disk\n";
         return EXIT_FAILURE;
     }
 
@@ -25,35 +56,213 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    itkexp::BSplineParameters params;
+    std::string fieldFile, transformFile;
+    std::size_t ceilingMB = 0;
+    itkexp::TiledParameters tiled;
+    bool compareOptimizers = false;
+    for (int i = 5; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--levels" && i + 1 < argc) {
+            params.numberOfLevels = std::stoi(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            params.iterations = std::stoi(argv[++i]);
+        } else if (arg == "--optimizer" && i + 1 < argc) {
+            params.optimizer = itkexp::parseBSplineOptimizer(argv[++i]);
+        } else if (arg == "--lbfgsb-bound" && i + 1 < argc) {
+            params.lbfgsbBound = std::stod(argv[++i]);
+        } else if (arg == "--lbfgsb-memory" && i + 1 < argc) {
+            params.lbfgsbMemory = std::stoi(argv[++i]);
+        } else if (arg == "--sgd-samples" && i + 1 < argc) {
+            params.stochasticSamples = std::stoi(argv[++i]);
+        } else if (arg == "--sgd-decay" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%lf,%lf", &params.stochasticOffset,
+                       &params.stochasticAlpha) != 2) {
+                std::cerr << "Invalid decay. Use e.g. 20,0.602\n";
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--compare-optimizers") {
+            compareOptimizers = true;
+        } else if (arg == "--displacement-field" && i + 1 < argc) {
+            fieldFile = argv[++i];
+        } else if (arg == "--transform-out" && i + 1 < argc) {
+            transformFile = argv[++i];
+        } else if (arg == "--mem-ceiling" && i + 1 < argc) {
+            ceilingMB = std::stoul(argv[++i]);
+        } else if (arg == "--tiled-iterations" && i + 1 < argc) {
+            tiled.iterations = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     constexpr unsigned int Dimension = 3;
     using PixelType = float;
     using ImageType = itk::Image<PixelType, Dimension>;
 
+    // The composite (B-spline, then affine) as one .tfm, readable by itk_metrics --transform
+    auto writeTransform = [&](itk::CompositeTransform<double, Dimension>* transform) {
+        if (transformFile.empty())
+            return;
+        auto writer = itk::TransformFileWriterTemplate<double>::New();
+        writer->SetFileName(transformFile);
+        writer->SetInput(transform);
+        writer->Update();
+        std::cout << "💾 Transform written: " << transformFile << "\n";
+    };
+
     try {
+        if (ceilingMB > 0) {
+            // Memory-bounded: both stages warm-start on reduced copies and are refined with
+            // Mean Squares evaluated block by block at full resolution
+            if (!fieldFile.empty()) {
+                std::cerr << "--displacement-field needs the images in memory; it cannot be "
+                             "combined with --mem-ceiling\n";
+                return EXIT_FAILURE;
+            }
+            const std::size_t ceiling = ceilingMB * itkexp::MiB;
+            std::cout << "🧮 Memory ceiling " << ceilingMB << " MiB\n";
+            const itkexp::ScratchDirectory scratch(std::filesystem::path(outputFile).parent_path());
+            itkexp::TiledVolume<ImageType> fixed(fixedFile, scratch.path() / "fixed.mha",
+                                                 ceiling / 8);
+            itkexp::checkTiledOutput(fixed.information(), outputFile, ceiling);
+            const itkexp::TiledVolume<ImageType> moving(movingFile, scratch.path() / "moving.mha",
+                                                        ceiling / 8);
+
+            auto affine = itkexp::tiledAffineRegister<ImageType>(fixed, moving, ceiling, {}, tiled);
+            if (!affine)
+                return EXIT_FAILURE;
+            auto transform = itkexp::tiledBSplineRegister<ImageType>(fixed, moving, ceiling, mesh,
+                                                                     params, affine, tiled);
+            if (!transform)
+                return EXIT_FAILURE;
+            writeTransform(transform);
+
+            const auto layout = itkexp::tileLayoutForCeiling<ImageType>(ceiling, 0);
+            itkexp::writeTiledResampled<ImageType>(fixed, moving, transform, layout, outputFile,
+                                                   ceiling);
+            std::cout << "💾 B-spline result written: " << outputFile << "\n"
+                      << "   peak RSS: " << itkexp::peakResidentMiB() << " MiB\n";
+            return EXIT_SUCCESS;
+        }
+
         auto fixedReader = itk::ImageFileReader<ImageType>::New();
         auto movingReader = itk::ImageFileReader<ImageType>::New();
         fixedReader->SetFileName(fixedFile);
         movingReader->SetFileName(movingFile);
         fixedReader->Update();
         movingReader->Update();
+        ImageType::Pointer fixed  = fixedReader->GetOutput();
+        ImageType::Pointer moving = movingReader->GetOutput();
 
-        auto fixed  = fixedReader->GetOutput();
-        auto moving = movingReader->GetOutput();
+        // Affine warm start: the transform is chained in front of the B-spline, so the moving
+        // image is only interpolated once, in the final resample
+        std::cout << "🔧 Affine warm start...\n";
+        auto affine = itkexp::affineRegister<ImageType>(fixed, moving);
+        if (!affine) {
+            std::cerr << "Affine warm start failed\n";
+            return EXIT_FAILURE;
+        }
 
-        // Optional: do an **affine warm start** to help the B-spline
-        std::cout << "🔧 (Optional) Affine warm start...\n";
-        // 🔧 Optional affine warm start: save intermediate output for inspection
-        const std::string affineTmpPath = "output/temp_affine_init.nrrd";
-        std::cout << "🔧 Performing affine warm start → " << affineTmpPath << "\n";
-        auto affineInit = itkexp::registerImages<ImageType>(fixed, moving, affineTmpPath);
+        if (compareOptimizers) {
+            // Dense Mattes MI with RSGD against fresh random samples with SGD, from the same
+            // affine start: wall time, time per iteration and how well each result matches
+            struct Row
+            {
+                const char*   name;
+                double        seconds;
+                unsigned long iterations;
+                double        mse;
+                double        ncc;
+            };
+            std::vector<Row> rows;
+            ImageType::Pointer stochasticResult;
+            itk::CompositeTransform<double, Dimension>::Pointer stochasticTransform;
+            for (const auto optimizer :
+                 {itkexp::BSplineOptimizer::RegularStep, itkexp::BSplineOptimizer::Stochastic}) {
+                auto runParams = params;
+                runParams.optimizer = optimizer;
+                itkexp::RegistrationStats stats;
+                const auto start = std::chrono::steady_clock::now();
+                auto transform = itkexp::bsplineRegisterTransform<ImageType>(
+                    fixed, moving, mesh, runParams, affine, &stats);
+                const double seconds =
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                        .count();
+                if (!transform)
+                    return EXIT_FAILURE;
+                auto result = itkexp::resampleToFixed<ImageType>(fixed, moving, transform);
+                rows.push_back({optimizer == itkexp::BSplineOptimizer::Stochastic
+                                    ? "sgd (sampled)"
+                                    : "rsgd (dense)",
+                                seconds, stats.iterations,
+                                itkexp::computeMSE<ImageType>(fixed, result),
+                                itkexp::computeNCC<ImageType>(fixed, result)});
+                stochasticResult = result;
+                stochasticTransform = transform;
+            }
 
+            std::cout << "\n" << std::left << std::setw(16) << "optimizer" << std::right
+                      << std::setw(10) << "time [s]" << std::setw(12) << "iterations"
+                      << std::setw(14) << "s/iteration" << std::setw(14) << "MSE"
+                      << std::setw(10) << "NCC" << "\n";
+            for (const auto& r : rows)
+                std::cout << std::left << std::setw(16) << r.name << std::right << std::fixed
+                          << std::setprecision(2) << std::setw(10) << r.seconds
+                          << std::setw(12) << r.iterations << std::setprecision(4)
+                          << std::setw(14) << r.seconds / std::max(1ul, r.iterations)
+                          << std::setprecision(2) << std::setw(14) << r.mse
+                          << std::setprecision(4) << std::setw(10) << r.ncc << "\n"
+                          << std::defaultfloat;
+
+            auto writer = itk::ImageFileWriter<ImageType>::New();
+            writer->SetFileName(outputFile);
+            writer->SetInput(stochasticResult);
+            writer->Update();
+            std::cout << "💾 B-spline result (sgd) written: " << outputFile << std::endl;
+            writeTransform(stochasticTransform);
+            return EXIT_SUCCESS;
+        }
 
         // Deformable refinement (B-spline)
-        itkexp::bsplineRegister<ImageType>(fixed, moving, mesh, outputFile);
+        if (fieldFile.empty() && transformFile.empty()) {
+            auto result = itkexp::bsplineRegister<ImageType>(fixed, moving, mesh, outputFile,
+                                                             params, affine);
+            if (!result)
+                return EXIT_FAILURE;
+        } else {
+            auto transform = itkexp::bsplineRegisterTransform<ImageType>(fixed, moving, mesh,
+                                                                         params, affine);
+            if (!transform)
+                return EXIT_FAILURE;
+            writeTransform(transform);
+
+            ImageType::Pointer result;
+            if (fieldFile.empty()) {
+                result = itkexp::resampleToFixed<ImageType>(fixed, moving, transform);
+            } else {
+                // Evaluate the transform chain once into a dense field, then warp through the
+                // field so the same field can be reused later with itk_warp
+                auto field = itkexp::computeDisplacementField<ImageType>(transform, fixed);
+                itkexp::writeDisplacementField<Dimension>(field, fieldFile);
+                result = itkexp::warpImage<ImageType>(moving, field);
+            }
+
+            auto writer = itk::ImageFileWriter<ImageType>::New();
+            writer->SetFileName(outputFile);
+            writer->SetInput(result);
+            writer->Update();
+            std::cout << "💾 B-spline result written: " << outputFile << std::endl;
+        }
     }
     catch (const itk::ExceptionObject& e) {
         std::cerr << "ITK Exception: " << e << std::endl;
         return EXIT_FAILURE;
     }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
@@ -26,7 +26,8 @@ struct CommandLineArgs
     std::string fixedLandmarksPath;
     std::string movingLandmarksPath;
     std::string evalOutputPath;
-    bool        verbose = false;
+    bool        uniformShrink = false;
+    bool        verbose       = false;
 };
 
 void PrintUsage(const char* progName)
@@ -43,6 +44,7 @@ void PrintUsage(const char* progName)
     std::cout << "  --fixed-landmarks <csv>  Fixed image landmarks\n";
     std::cout << "  --moving-landmarks <csv> Moving image landmarks\n";
     std::cout << "  --eval-output <csv>      Save evaluation results\n";
+    std::cout << "  --uniform-shrink         Same shrink on every pyramid axis\n";
     std::cout << "  --verbose                Print detailed output\n";
     std::cout << "\nDefault parameters are optimized for 3D registration.\n";
     std::cout << "For 2D images, consider: --learning-rate 0.001 --relaxation 0.95\n";
@@ -81,6 +83,8 @@ CommandLineArgs ParseCommandLine(int argc, char* argv[])
             args.movingLandmarksPath = argv[++i];
         } else if (arg == "--eval-output" && i + 1 < argc) {
             args.evalOutputPath = argv[++i];
+        } else if (arg == "--uniform-shrink") {
+            args.uniformShrink = true;
         } else if (arg == "--verbose") {
             args.verbose = true;
         }
@@ -114,11 +118,12 @@ int main(int argc, char* argv[])
 
         // Set parameters
         Registration::RegistrationParameters params;
-        params.maxIterations    = args.iterations;
-        params.pyramidLevels    = args.pyramidLevels;
-        params.learningRate     = args.learningRate;
-        params.relaxationFactor = args.relaxationFactor;
-        params.verbose          = args.verbose;
+        params.maxIterations     = args.iterations;
+        params.pyramidLevels     = args.pyramidLevels;
+        params.learningRate      = args.learningRate;
+        params.relaxationFactor  = args.relaxationFactor;
+        params.anisotropicShrink = !args.uniformShrink;
+        params.verbose           = args.verbose;
         registration.SetParameters(params);
 
         // Load images
@@ -1,5 +1,9 @@
+#include "registration/MemoryBudget.hpp"
 #include "registration/Registration.hpp"
+#include "registration/TiledMetric.hpp"
 #include "itkImageFileReader.h"
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 
 int main(int argc, char* argv[])
@@ -7,7 +11,15 @@ int main(int argc, char* argv[])
     if (argc < 4)
     {
         std::cerr << "Usage: " << argv[0]
-                  << " fixedImage.nrrd movingImage.nrrd outputRegistered.nrrd\n";
+                  << " fixedImage.nrrd movingImage.nrrd outputRegistered.nrrd [options]\n"
+                     "  --levels N            pyramid levels (default: 3)\n"
+                     "  --iterations LIST     per level, coarse to fine (default: 200,100,50)\n"
+                     "  --single-level        full resolution, unscaled, 200 iterations\n"
+                     "  --mem-ceiling MB      stay within MB: reduced warm start, then tiled\n"
+                     "                        full-resolution Mean Squares\n"
+                     "  --tiled-iterations N  full-resolution passes with --mem-ceiling"
+                     " (default: 30); each\n"
+                     "                        pass reads the moving volume from disk\n";
         return EXIT_FAILURE;
     }
 
@@ -15,12 +27,67 @@ int main(int argc, char* argv[])
     const std::string movingFile = argv[2];
     const std::string outputFile = argv[3];
 
+    std::size_t ceilingMB = 0;
+    itkexp::AffineParameters params;
+    itkexp::TiledParameters tiled;
+    for (int i = 4; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--mem-ceiling" && i + 1 < argc)
+            ceilingMB = std::stoul(argv[++i]);
+        else if (arg == "--tiled-iterations" && i + 1 < argc)
+            tiled.iterations = std::stoul(argv[++i]);
+        else if (arg == "--levels" && i + 1 < argc)
+            params.numberOfLevels = std::stoi(argv[++i]);
+        else if (arg == "--iterations" && i + 1 < argc)
+            params.iterations = itkexp::parseIterationSchedule(argv[++i]);
+        else if (arg == "--single-level")
+            params = itkexp::singleLevelAffineParameters();
+        else
+        {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     constexpr unsigned int Dimension = 3;
     using PixelType = float;
     using ImageType = itk::Image<PixelType, Dimension>;
 
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start] {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
     try
     {
+        if (ceilingMB > 0)
+        {
+            // Memory-bounded: warm start on reduced copies, then Mean Squares evaluated block by
+            // block at full resolution
+            const std::size_t ceiling = ceilingMB * itkexp::MiB;
+            std::cout << "🧮 Memory ceiling " << ceilingMB << " MiB\n";
+            const itkexp::ScratchDirectory scratch(std::filesystem::path(outputFile).parent_path());
+            itkexp::TiledVolume<ImageType> fixed(fixedFile, scratch.path() / "fixed.mha",
+                                                 ceiling / 8);
+            itkexp::checkTiledOutput(fixed.information(), outputFile, ceiling);
+            const itkexp::TiledVolume<ImageType> moving(movingFile, scratch.path() / "moving.mha",
+                                                        ceiling / 8);
+
+            auto transform =
+                itkexp::tiledAffineRegister<ImageType>(fixed, moving, ceiling, params, tiled);
+            if (!transform)
+                return EXIT_FAILURE;
+
+            const auto layout = itkexp::tileLayoutForCeiling<ImageType>(ceiling, 0);
+            itkexp::writeTiledResampled<ImageType>(fixed, moving, transform, layout, outputFile,
+                                                   ceiling);
+            std::cout << "💾 Registered image written to: " << outputFile << "\n"
+                      << "   peak RSS: " << itkexp::peakResidentMiB() << " MiB, total "
+                      << elapsed() << " s\n";
+            return EXIT_SUCCESS;
+        }
+
         auto fixedReader = itk::ImageFileReader<ImageType>::New();
         auto movingReader = itk::ImageFileReader<ImageType>::New();
 
@@ -32,13 +99,22 @@ int main(int argc, char* argv[])
         auto fixedImage = fixedReader->GetOutput();
         auto movingImage = movingReader->GetOutput();
 
-        itkexp::registerImages<ImageType>(fixedImage, movingImage, outputFile);
+        auto result = itkexp::registerAffine<ImageType>(fixedImage, movingImage, outputFile,
+                                                        nullptr, params);
+        if (!result)
+            return EXIT_FAILURE;
+        std::cout << "⏱️ Total " << elapsed() << " s\n";
     }
     catch (const itk::ExceptionObject& e)
     {
         std::cerr << "ITK Exception: " << e << std::endl;
         return EXIT_FAILURE;
     }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -1,35 +1,44 @@
+#include "io/ImageIO.hpp"
 #include "segmentation/Segmentation.hpp"
-#include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
+#include <cstring>
 #include <iostream>
 
 int main(int argc, char* argv[])
 {
     if (argc < 3)
     {
-        std::cerr << "Usage: " << argv[0] << " inputImage outputMask\n";
+        std::cerr << "Usage: " << argv[0] << " inputImage outputMask [--float]\n"
+                  << "  --float   segment a float copy instead of the stored pixel type\n";
         return EXIT_FAILURE;
     }
 
     const char* inputFile = argv[1];
     const char* outputFile = argv[2];
+    const bool asFloat = argc > 3 && std::strcmp(argv[3], "--float") == 0;
 
     constexpr unsigned int Dimension = 3;
-    using PixelType = float;
-    using ImageType = itk::Image<PixelType, Dimension>;
     using LabelImageType = itk::Image<unsigned short, Dimension>;
+    using MaskType = itkexp::MaskImageType<Dimension>;
 
     try
     {
-        auto reader = itk::ImageFileReader<ImageType>::New();
-        reader->SetFileName(inputFile);
-        reader->Update();
+        // The image is thresholded in the pixel type stored on disk (e.g. uint16), not as float
+        auto info = itkexp::readImageInformation(inputFile);
+        if (asFloat)
+            info.component = itk::IOComponentEnum::FLOAT;
 
-        // 1. Otsu threshold
-        auto mask = itkexp::otsuThreshold<ImageType>(reader->GetOutput());
+        LabelImageType::Pointer labels;
+        itkexp::visitComponentType(info, [&]<typename TPixel>() {
+            auto image = itkexp::ImageIO<TPixel, Dimension>::readImage(inputFile);
+            itkexp::printPixelMemory(image.GetPointer(), inputFile);
 
-        // 2. Connected component labeling
-        auto labels = itkexp::labelComponents<ImageType>(mask);
+            // 1. Otsu threshold
+            auto mask = itkexp::otsuThreshold(image.GetPointer());
+
+            // 2. Connected component labeling
+            labels = itkexp::labelComponents<MaskType>(mask);
+        });
 
         auto writer = itk::ImageFileWriter<LabelImageType>::New();
         writer->SetFileName(outputFile);
@@ -43,6 +52,11 @@ int main(int argc, char* argv[])
         std::cerr << "ITK Exception: " << e << std::endl;
         return EXIT_FAILURE;
     }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
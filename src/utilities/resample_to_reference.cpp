@@ -6,11 +6,12 @@
 
 #include <itkIdentityTransform.h>
 #include <itkImage.h>
-#include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
 #include <itkLinearInterpolateImageFunction.h>
 #include <itkResampleImageFilter.h>
 
+#include "io/ImageIO.hpp"
+
 int main(int argc, char* argv[])
 {
     if (argc != 4) {
@@ -24,7 +25,7 @@ int main(int argc, char* argv[])
 
     // Type definitions
     using ImageType          = itk::Image<float, 3>;
-    using ReaderType         = itk::ImageFileReader<ImageType>;
+    using IO                 = itkexp::ImageIO<float, 3>;
     using WriterType         = itk::ImageFileWriter<ImageType>;
     using TransformType      = itk::IdentityTransform<double, 3>;
     using InterpolatorType   = itk::LinearInterpolateImageFunction<ImageType, double>;
@@ -33,18 +34,11 @@ int main(int argc, char* argv[])
     try {
         // Read moving image
         std::cout << "Reading moving image: " << argv[1] << std::endl;
-        auto movingReader = ReaderType::New();
-        movingReader->SetFileName(argv[1]);
-        movingReader->Update();
+        ImageType::Pointer movingImage = IO::readImage(argv[1]);
 
         // Read fixed image (reference)
         std::cout << "Reading fixed image: " << argv[2] << std::endl;
-        auto fixedReader = ReaderType::New();
-        fixedReader->SetFileName(argv[2]);
-        fixedReader->Update();
-
-        ImageType::Pointer movingImage = movingReader->GetOutput();
-        ImageType::Pointer fixedImage  = fixedReader->GetOutput();
+        ImageType::Pointer fixedImage = IO::readImage(argv[2]);
 
         // Create identity transform (no rotation, no translation)
         auto transform = TransformType::New();
@@ -86,5 +80,8 @@ int main(int argc, char* argv[])
     } catch (const itk::ExceptionObject& e) {
         std::cerr << "Error: " << e << std::endl;
         return 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
 }
\ No newline at end of file
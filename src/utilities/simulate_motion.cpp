@@ -10,10 +10,10 @@
 
 #include "itkEuler3DTransform.h"
 #include "itkImage.h"
-#include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkLinearInterpolateImageFunction.h"
 #include "itkResampleImageFilter.h"
+#include "io/ImageIO.hpp"
 
 using ImageType     = itk::Image<float, 3>;
 using TransformType = itk::Euler3DTransform<double>;
@@ -63,11 +63,8 @@ int main(int argc, char* argv[])
 
     try {
         // Read input image
-        auto reader = itk::ImageFileReader<ImageType>::New();
-        reader->SetFileName(inputPath);
-        reader->Update();
-
-        ImageType::Pointer inputImage = reader->GetOutput();
+        ImageType::Pointer inputImage =
+            itkexp::ImageIO<ImageType::PixelType, 3>::readImage(inputPath);
 
         // Create transform
         auto transform = TransformType::New();
@@ -117,5 +114,8 @@ int main(int argc, char* argv[])
     } catch (const itk::ExceptionObject& e) {
         std::cerr << "Error: " << e << std::endl;
         return 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
 }
\ No newline at end of file
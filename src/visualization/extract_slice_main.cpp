@@ -2,15 +2,17 @@
 
 #include "itkExtractImageFilter.h"
 #include "itkImage.h"
-#include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkRescaleIntensityImageFilter.h"
+#include "io/ImageIO.hpp"
 
 int main(int argc, char* argv[])
 {
     if (argc < 5) {
-        std::cout << "Usage: " << argv[0] << " <input.nii.gz> <output.png> <axis> <slice>\n";
+        std::cout << "Usage: " << argv[0]
+                  << " <input.nii.gz> <output.png> <axis> <slice> [--float]\n";
         std::cout << "  axis: 0=sagittal, 1=coronal, 2=axial\n";
+        std::cout << "  --float: read the slab as float instead of the stored pixel type\n";
         return 1;
     }
 
@@ -19,76 +21,99 @@ int main(int argc, char* argv[])
     int         axis       = std::stoi(argv[3]);
     int         sliceNum   = std::stoi(argv[4]);
 
-    using InputPixelType  = float;
-    using OutputPixelType = unsigned char;
-    using InputImageType  = itk::Image<InputPixelType, 3>;
-    using SliceImageType  = itk::Image<InputPixelType, 2>;  // ← KEEP FLOAT for slice!
-    using OutputImageType = itk::Image<OutputPixelType, 2>;
+    const bool asFloat = argc > 5 && std::string(argv[5]) == "--float";
 
-    // Read 3D image
-    auto reader = itk::ImageFileReader<InputImageType>::New();
-    reader->SetFileName(inputPath);
+    using OutputImageType = itk::Image<unsigned char, 2>;
 
+    // Size and pixel type from the header; only the slice itself is read below
+    itkexp::ImageInformation info;
+    itk::Size<3>             size;
     try {
-        reader->Update();
-    } catch (const itk::ExceptionObject& e) {
-        std::cerr << "Error reading: " << e << std::endl;
+        info = itkexp::readImageInformation(inputPath);
+        if (info.dimension != 3) {
+            std::cerr << "Error: " << inputPath << " is not a 3D image\n";
+            return 1;
+        }
+        for (unsigned int d = 0; d < 3; ++d)
+            size[d] = info.size[d];
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
         return 1;
     }
-
-    InputImageType::Pointer    image  = reader->GetOutput();
-    InputImageType::RegionType region = image->GetLargestPossibleRegion();
-    InputImageType::SizeType   size   = region.GetSize();
+    if (asFloat)
+        info.component = itk::IOComponentEnum::FLOAT;
 
     std::cout << "Image size: " << size[0] << " x " << size[1] << " x " << size[2] << std::endl;
     std::cout << "Extracting slice " << sliceNum << " along axis " << axis << std::endl;
 
-    // Validate slice number
+    // Validate axis and slice number
+    if (axis < 0 || axis > 2) {
+        std::cerr << "Error: axis must be 0, 1 or 2\n";
+        return 1;
+    }
     if (sliceNum < 0 || sliceNum >= static_cast<int>(size[axis])) {
         std::cerr << "Error: Slice " << sliceNum << " out of range [0, " << size[axis] - 1 << "]\n";
         return 1;
     }
 
-    // Set up extraction region - collapse one dimension
-    InputImageType::RegionType extractionRegion = region;
-    InputImageType::SizeType   extractSize      = size;
-    InputImageType::IndexType  extractIndex     = region.GetIndex();
-
-    // Set the slice dimension to 0 (collapse to 2D)
-    extractSize[axis]  = 0;
-    extractIndex[axis] = sliceNum;
-
-    extractionRegion.SetSize(extractSize);
-    extractionRegion.SetIndex(extractIndex);
-
-    // Extract filter - KEEP FLOAT TYPE!
-    using ExtractFilterType = itk::ExtractImageFilter<InputImageType, SliceImageType>;
-    //                                                 float 3D  →  float 2D  ✓ CORRECT!
-    auto extractor = ExtractFilterType::New();
-    extractor->SetInput(image);
-    extractor->SetExtractionRegion(extractionRegion);
-    extractor->SetDirectionCollapseToIdentity();
-
-    // NOW rescale float 2D → unsigned char 2D
-    using RescaleFilterType = itk::RescaleIntensityImageFilter<SliceImageType, OutputImageType>;
-    //                                                          float 2D  →  uchar 2D  ✓ CORRECT!
-    auto rescaler = RescaleFilterType::New();
-    rescaler->SetInput(extractor->GetOutput());
-    rescaler->SetOutputMinimum(0);
-    rescaler->SetOutputMaximum(255);
-
-    // Write PNG
-    auto writer = itk::ImageFileWriter<OutputImageType>::New();
-    writer->SetFileName(outputPath);
-    writer->SetInput(rescaler->GetOutput());
+    // A one-voxel-thick slab holding the slice
+    itk::Index<3> slabIndex{};
+    itk::Size<3>  slabSize = size;
+    slabIndex[axis]        = sliceNum;
+    slabSize[axis]         = 1;
+    const itk::ImageRegion<3> slabRegion(slabIndex, slabSize);
 
+    // The slab is read and extracted in the pixel type stored on disk; only the rescale to
+    // 0..255 looks at the intensities
     try {
-        writer->Update();
+        itkexp::visitComponentType(info, [&]<typename InputPixelType>() {
+            using InputImageType = itk::Image<InputPixelType, 3>;
+            using SliceImageType = itk::Image<InputPixelType, 2>;
+
+            // Streamed where the format allows
+            bool streamed = false;
+            auto image = itkexp::ImageIO<InputPixelType, 3>::readRegion(inputPath, slabRegion,
+                                                                        &streamed);
+            std::cout << (streamed ? "Streamed the slab" : "Read whole volume (format cannot "
+                                                           "stream), kept the slab")
+                      << std::endl;
+            itkexp::printPixelMemory(image.GetPointer(), inputPath);
+
+            // Set up extraction region - collapse the slab's one-voxel dimension to 2D
+            auto extractionRegion = slabRegion;
+            auto extractSize      = slabSize;
+            extractSize[axis]     = 0;
+            extractionRegion.SetSize(extractSize);
+
+            // Extract filter keeps the input pixel type: 3D -> 2D
+            using ExtractFilterType = itk::ExtractImageFilter<InputImageType, SliceImageType>;
+            auto extractor          = ExtractFilterType::New();
+            extractor->SetInput(image);
+            extractor->SetExtractionRegion(extractionRegion);
+            extractor->SetDirectionCollapseToIdentity();
+
+            // Rescale 2D -> unsigned char 2D
+            using RescaleFilterType =
+                itk::RescaleIntensityImageFilter<SliceImageType, OutputImageType>;
+            auto rescaler = RescaleFilterType::New();
+            rescaler->SetInput(extractor->GetOutput());
+            rescaler->SetOutputMinimum(0);
+            rescaler->SetOutputMaximum(255);
+
+            // Write PNG
+            auto writer = itk::ImageFileWriter<OutputImageType>::New();
+            writer->SetFileName(outputPath);
+            writer->SetInput(rescaler->GetOutput());
+            writer->Update();
+        });
         std::cout << "Saved: " << outputPath << std::endl;
     } catch (const itk::ExceptionObject& e) {
         std::cerr << "Error writing: " << e << std::endl;
         return 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}